@@ -10,31 +10,72 @@ Modify by Yefri Gonzalez (Th3Cod3)
 */
 
 #include <avr/io.h>
+#include <util/atomic.h>
 #include "dcmotor.h"
 
+/*
+ * set the duty cycle of the enable pin, 0..DCMOTOR_PWM_TOP
+ */
+static void dcmotor_duty(DcMotor motor, uint16_t duty)
+{
+    if (!motor.ddrPwm)
+        return;
+    // the 16 bit write goes through the TEMP register shared with the interrupts
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        *motor.ocr = duty;
+    }
+}
 
 void dcmotor_instruction(DcMotor motor, char instruction)
 {
     switch (instruction)
     {
     case DCMOTOR_FORWARD:
-        if (dcmotor_end_limit(motor))
-            return dcmotor_instruction(motor, DCMOTOR_STOP);
-        *motor.portA |= _BV(motor.pinA);
-        *motor.portB &= ~_BV(motor.pinB);
+        dcmotor_set_speed(motor, DCMOTOR_SPEED_MAX);
         return;
 
     case DCMOTOR_BACKWARD:
-        if (dcmotor_start_limit(motor))
-            return dcmotor_instruction(motor, DCMOTOR_STOP);
-        *motor.portA &= ~_BV(motor.pinA);
-        *motor.portB |= _BV(motor.pinB);
+        dcmotor_set_speed(motor, -DCMOTOR_SPEED_MAX);
         return;
 
     case DCMOTOR_STOP:
+        dcmotor_set_speed(motor, 0);
+        return;
+    }
+}
+
+/*
+ * drive the motor with a signed speed, -DCMOTOR_SPEED_MAX..DCMOTOR_SPEED_MAX
+ * positive is forward, the motor stops at the limit in its direction
+ */
+void dcmotor_set_speed(DcMotor motor, int16_t speed)
+{
+    if (speed > DCMOTOR_SPEED_MAX)
+        speed = DCMOTOR_SPEED_MAX;
+    else if (speed < -DCMOTOR_SPEED_MAX)
+        speed = -DCMOTOR_SPEED_MAX;
+
+    if ((speed > 0 && dcmotor_end_limit(motor)) || (speed < 0 && dcmotor_start_limit(motor)))
+        speed = 0;
+
+    if (speed > 0)
+    {
+        *motor.portA |= _BV(motor.pinA);
+        *motor.portB &= ~_BV(motor.pinB);
+        dcmotor_duty(motor, speed);
+    }
+    else if (speed < 0)
+    {
+        *motor.portA &= ~_BV(motor.pinA);
+        *motor.portB |= _BV(motor.pinB);
+        dcmotor_duty(motor, -speed);
+    }
+    else
+    {
         *motor.portA &= ~_BV(motor.pinA);
         *motor.portB &= ~_BV(motor.pinB);
-        return;
+        dcmotor_duty(motor, 0);
     }
 }
 
@@ -49,6 +90,15 @@ void dcmotor_init(DcMotor motor)
     *motor.ddrLimitB &= ~_BV(motor.limitB);   // output
     *motor.portLimitA |= _BV(motor.limitA);   // output
     *motor.portLimitB |= _BV(motor.limitB);   // output
+    if (motor.ddrPwm)
+    {
+        // fast PWM mode 14, bit positions are the same for timer 1, 3, 4 and 5
+        *motor.icr = DCMOTOR_PWM_TOP;
+        *motor.ocr = 0;
+        *motor.tccrA = (*motor.tccrA & ~(_BV(WGM10))) | _BV(WGM11) | motor.com;
+        *motor.tccrB = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+        *motor.ddrPwm |= _BV(motor.pinPwm); // output
+    }
     dcmotor_instruction(motor, DCMOTOR_STOP);
 }
 
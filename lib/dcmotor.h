@@ -5,6 +5,14 @@
 #define DCMOTOR_FORWARD 1
 #define DCMOTOR_BACKWARD 2
 
+/*
+ * The enable pin of the bridge is driven with fast PWM (mode 14, TOP in
+ * ICRn, no prescaler) by one of the 16 bit timers 1, 3, 4 or 5.
+ * TOP 799 gives 20 kHz at 16 MHz, above the audible range.
+ */
+#define DCMOTOR_PWM_TOP 799
+#define DCMOTOR_SPEED_MAX DCMOTOR_PWM_TOP // dcmotor_set_speed() range is -max..max
+
 typedef struct
 {
     volatile uint8_t *ddrA;
@@ -21,9 +29,17 @@ typedef struct
     volatile uint8_t *pinLimitB;
     uint8_t limitA;
     uint8_t limitB;
+    volatile uint8_t *ddrPwm; // 0 when the enable pin is not used, the motor runs at full speed
+    uint8_t pinPwm;
+    volatile uint8_t *tccrA;  // TCCRnA of the PWM timer
+    volatile uint8_t *tccrB;  // TCCRnB of the PWM timer
+    volatile uint16_t *icr;   // ICRn of the PWM timer
+    volatile uint16_t *ocr;   // OCRnx of the enable pin
+    uint8_t com;              // COMnx1 bit of the enable pin
 } DcMotor;
 
 extern void dcmotor_instruction(DcMotor motor, char instruction);
+extern void dcmotor_set_speed(DcMotor motor, int16_t speed);
 extern uint8_t dcmotor_start_limit(DcMotor motor);
 extern uint8_t dcmotor_end_limit(DcMotor motor);
 extern void dcmotor_init(DcMotor motor);
@@ -0,0 +1,88 @@
+/*
+event lib 0x01
+
+Single producer, single consumer event queue from the interrupts to
+the main loop.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include <util/atomic.h>
+#include "event.h"
+
+#if EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)
+#error EVENT_QUEUE_SIZE must be a power of two
+#endif
+
+#define EVENT_MASK (EVENT_QUEUE_SIZE - 1)
+
+static Event event_queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t event_head = 0; // written by the producer only
+static volatile uint8_t event_tail = 0; // written by the consumer only
+static uint16_t event_overflow = 0;     // events dropped because the queue was full
+
+/*
+ * queue an event, call from interrupt context
+ * returns 0 on success, 1 when the queue was full and the event is dropped
+ */
+uint8_t event_push(uint8_t type, int8_t data)
+{
+    uint8_t head = event_head;
+
+    if (((head + 1) & EVENT_MASK) == event_tail)
+    {
+        event_overflow++;
+        return 1;
+    }
+    event_queue[head].type = type;
+    event_queue[head].data = data;
+    event_head = (head + 1) & EVENT_MASK; // publish after the entry is written
+    return 0;
+}
+
+/*
+ * queue an event from the main loop, interrupts are held off so it
+ * does not race with an event_push() of an interrupt
+ */
+uint8_t event_post(uint8_t type, int8_t data)
+{
+    uint8_t result;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        result = event_push(type, data);
+    }
+    return result;
+}
+
+/*
+ * take the oldest event, call from the main loop
+ * returns 1 when an event was copied to event, 0 when the queue is empty
+ */
+uint8_t event_pop(Event *event)
+{
+    uint8_t tail = event_tail;
+
+    if (tail == event_head)
+    {
+        return 0;
+    }
+    *event = event_queue[tail];
+    event_tail = (tail + 1) & EVENT_MASK; // release the entry after the copy
+    return 1;
+}
+
+/*
+ * events dropped since start, used to size EVENT_QUEUE_SIZE
+ */
+uint16_t event_overflows(void)
+{
+    uint16_t overflows;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        overflows = event_overflow;
+    }
+    return overflows;
+}
@@ -0,0 +1,31 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <inttypes.h>
+
+/*
+ * Events from the interrupts to the main loop. The interrupts do not nest,
+ * so together they are the single producer and the main loop is the single
+ * consumer: event_push() and event_pop() need no locking.
+ */
+#define EVENT_QUEUE_SIZE 32 // power of two
+
+// event types
+#define EVENT_ENCODER 1   // screen encoder detent, data is -1 or +1
+#define EVENT_BUTTON 2    // screen encoder button pressed
+#define EVENT_LIMIT 3     // limit switch hit, data is the mask of new limits
+#define EVENT_EMERGENCY 4 // emergency stop pressed, the motors are already stopped
+#define EVENT_MOVE_DONE 5 // axis reached its setpoint, data is the axis
+
+typedef struct
+{
+    uint8_t type;
+    int8_t data;
+} Event;
+
+extern uint8_t event_push(uint8_t type, int8_t data);
+extern uint8_t event_post(uint8_t type, int8_t data);
+extern uint8_t event_pop(Event *event);
+extern uint16_t event_overflows(void);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+grid lib 0x01
+
+Cell coordinates of a grid of boxes, precomputed from the box geometry.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "grid.h"
+
+// half millimetres to counts, the cell centres fall on half millimetres
+static int32_t grid_counts(Grid *grid, uint8_t axis, int32_t halfMillimetre)
+{
+    return (halfMillimetre * grid->countsPerMm[axis] + 256) / 512;
+}
+
+/*
+ * centres of the boxes along one axis that fit in travel,
+ * returns the number of boxes
+ */
+static uint8_t grid_axis(Grid *grid, uint8_t axis, uint8_t dimension, uint8_t margin, int32_t *centre, uint8_t count)
+{
+    uint16_t pitch = dimension + margin;
+
+    if (!pitch)
+        return 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint16_t start = margin + i * pitch;
+        if (start + dimension > grid->travel[axis])
+            return i;
+        centre[i] = grid_counts(grid, axis, 2 * start + dimension);
+    }
+    return count;
+}
+
+void grid_init(Grid *grid, const uint16_t *countsPerMm, const uint16_t *travel)
+{
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        grid->countsPerMm[i] = countsPerMm[i];
+        grid->travel[i] = travel[i];
+        grid->dimension[i] = 0;
+        grid->margin[i] = 0;
+    }
+    grid->columns = 0;
+    grid->rows = 0;
+    grid->clear = 0;
+    grid->grip = 0;
+}
+
+/*
+ * rebuild the tables when the geometry changed, cheap to call otherwise
+ * returns 1 when the tables were rebuilt
+ */
+uint8_t grid_configure(Grid *grid, const uint8_t *dimension, const uint8_t *margin)
+{
+    uint8_t changed = 0;
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (grid->dimension[i] != dimension[i] || grid->margin[i] != margin[i])
+            changed = 1;
+        grid->dimension[i] = dimension[i];
+        grid->margin[i] = margin[i];
+    }
+    if (!changed)
+        return 0;
+
+    grid->columns = grid_axis(grid, 0, dimension[GRID_LENGTH], margin[GRID_LENGTH], grid->column, GRID_COLUMNS);
+    grid->rows = grid_axis(grid, 1, dimension[GRID_DEPTH], margin[GRID_DEPTH], grid->row, GRID_ROWS);
+
+    int32_t bottom = 2 * (int32_t)grid->travel[2];
+    int32_t clear = bottom - 2 * (dimension[GRID_HEIGHT] + margin[GRID_HEIGHT]);
+    grid->clear = grid_counts(grid, 2, clear > 0 ? clear : 0);
+    grid->grip = grid_counts(grid, 2, bottom - dimension[GRID_HEIGHT]);
+    return 1;
+}
+
+/*
+ * position of the box in a cell: centre and grip height
+ * returns 0 when the cell is outside the travel
+ */
+uint8_t grid_cell(Grid *grid, uint8_t column, uint8_t row, int32_t *position)
+{
+    if (column >= grid->columns || row >= grid->rows)
+        return 0;
+    position[0] = grid->column[column];
+    position[1] = grid->row[row];
+    position[2] = grid->grip;
+    return 1;
+}
@@ -0,0 +1,41 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <inttypes.h>
+
+/*
+ * Coordinates of a grid of boxes, columns run along X and rows along Y.
+ * The tables are built from the box geometry whenever it changes, the
+ * position of a cell is then a lookup of its column and of its row.
+ *
+ * Box dimension and margin are {length (X), height (Z), depth (Y)} in mm.
+ * The X/Y margin is the gap between the boxes and to the start of the
+ * travel, the Z margin is the clearance above the boxes. Z counts down
+ * from the home at the top, travel[2] is the floor.
+ */
+#define GRID_COLUMNS 26 // A..Z
+#define GRID_ROWS 26
+
+#define GRID_LENGTH 0
+#define GRID_HEIGHT 1
+#define GRID_DEPTH 2
+
+typedef struct
+{
+    uint16_t countsPerMm[3];      // Q8.8, X Y Z
+    uint16_t travel[3];           // mm, X Y Z
+    uint8_t dimension[3];         // geometry the tables were built for
+    uint8_t margin[3];
+    uint8_t columns;              // cells that fit in the travel
+    uint8_t rows;
+    int32_t column[GRID_COLUMNS]; // X of the cell centres, counts
+    int32_t row[GRID_ROWS];       // Y of the cell centres, counts
+    int32_t clear;                // Z above the boxes, counts
+    int32_t grip;                 // Z at half the box height, counts
+} Grid;
+
+extern void grid_init(Grid *grid, const uint16_t *countsPerMm, const uint16_t *travel);
+extern uint8_t grid_configure(Grid *grid, const uint8_t *dimension, const uint8_t *margin);
+extern uint8_t grid_cell(Grid *grid, uint8_t column, uint8_t row, int32_t *position);
+
+#endif
@@ -8,6 +8,7 @@
  **************************************************************************/
 #include <inttypes.h>
 #include <compat/twi.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include "i2cmaster.h"
 
@@ -16,21 +17,88 @@
 //#define F_CPU 8000000UL
 #endif
 
-/* I2C clock in Hz */
-#define SCL_CLOCK 10000L
+/* I2C clock in Hz used by i2c_init(), the PCF8574 is specified up to 100 kHz */
+#ifndef I2C_SCL_CLOCK
+#define I2C_SCL_CLOCK I2C_SPEED_STANDARD
+#endif
+
+/* TWBR for I2C_SCL_CLOCK with prescaler 1 */
+#define I2C_TWBR ((F_CPU / I2C_SCL_CLOCK - 16) / 2)
+
+#if I2C_TWBR <= 10
+#error "I2C_SCL_CLOCK too high for F_CPU, TWBR must be > 10 for stable operation"
+#elif I2C_TWBR > 255
+#error "I2C_SCL_CLOCK too low for F_CPU, use i2c_init_speed() with a prescaler"
+#endif
+
+#if (F_CPU / I2C_SPEED_FAST - 16) / 2 <= 10
+#warning "F_CPU too low for I2C_SPEED_FAST, i2c_init_speed() will reject it"
+#endif
+
+/* TWCR values used by the interrupt driven engine */
+#define I2C_TWCR_START ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+#define I2C_TWCR_NEXT ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+#define I2C_TWCR_ACK ((1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (1 << TWEA))
+#define I2C_TWCR_STOP ((1 << TWINT) | (1 << TWEN) | (1 << TWSTO))
+#define I2C_TWCR_RESTART ((1 << TWINT) | (1 << TWSTO) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+
+static I2cTransaction *volatile i2c_queue[I2C_QUEUE_SIZE];
+static volatile uint8_t i2c_queue_head = 0; // next free slot, written by i2c_submit
+static volatile uint8_t i2c_queue_tail = 0; // transaction on the bus, written by TWI_vect
+static volatile uint8_t i2c_running = 0;
+static uint8_t i2c_index = 0;
+
+#ifdef I2C_STATS
+volatile I2cStats i2c_stats;
+#define I2C_COUNT(field) i2c_stats.field++
+#else
+#define I2C_COUNT(field)
+#endif
+
+I2cTiming i2c_timing;
 
 /*************************************************************************
  Initialization of the I2C bus interface. Need to be called only once
 *************************************************************************/
 void i2c_init(void)
 {
-    /* initialize TWI clock: 100 kHz clock, TWPS = 0 => prescaler = 1 */
-
-    TWSR = 0;                                         /* no prescaler */
-    TWBR = (uint8_t)(((F_CPU / SCL_CLOCK) - 16) / 2); /* must be > 10 for stable operation */
+    /* initialize TWI clock: I2C_SCL_CLOCK, TWPS = 0 => prescaler = 1 */
+    i2c_init_speed(I2C_SCL_CLOCK, 0);
 
 } /* i2c_init */
 
+/*************************************************************************
+ Initialization of the I2C bus interface for a given SCL frequency.
+ SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+ Return:  0 bus configured
+          1 TWBR out of range, bus unchanged
+*************************************************************************/
+uint8_t i2c_init_speed(uint32_t scl, uint8_t prescaler)
+{
+    uint16_t divider = 2 << (2 * (prescaler & 0x03)); /* 2 * 4^TWPS */
+    uint32_t twbr;
+
+    if (scl == 0 || F_CPU / scl <= 16)
+        return 1;
+
+    twbr = (F_CPU / scl - 16 + divider - 1) / divider;
+    if (twbr <= 10 || twbr > 255) /* must be > 10 for stable operation */
+        return 1;
+
+    TWSR = prescaler & 0x03;
+    TWBR = (uint8_t)twbr;
+
+    i2c_timing.twbr = (uint8_t)twbr;
+    i2c_timing.twps = prescaler & 0x03;
+    i2c_timing.scl = F_CPU / (16 + twbr * divider);
+
+    /* the transaction engine runs from TWI_vect */
+    sei();
+
+    return 0;
+
+} /* i2c_init_speed */
+
 uint8_t i2c_sync(void)
 {
     uint16_t timeout = 100;
@@ -52,6 +120,141 @@ uint8_t i2c_waitStop(void)
     }
     return timeout != 0;
 }
+
+/*************************************************************************
+ Queue a transaction for the interrupt driven engine and start the bus
+ if it is idle. Returns 0 when queued, 1 when the queue is full.
+*************************************************************************/
+uint8_t i2c_submit(I2cTransaction *transaction)
+{
+    uint8_t head = i2c_queue_head;
+    uint8_t next = (head + 1) & (I2C_QUEUE_SIZE - 1);
+
+    if (next == i2c_queue_tail)
+        return 1;
+
+    transaction->status = I2C_PENDING;
+    i2c_queue[head] = transaction;
+    i2c_queue_head = next;
+
+    if (!i2c_running)
+    {
+        i2c_running = 1;
+        i2c_index = 0;
+        i2c_waitStop(); // the STOP of the previous transaction may still be on the bus
+        TWCR = I2C_TWCR_START;
+    }
+    return 0;
+
+} /* i2c_submit */
+
+/*************************************************************************
+ Wait until a queued transaction left the I2C_PENDING state
+*************************************************************************/
+uint8_t i2c_wait(I2cTransaction *transaction)
+{
+    while (transaction->status == I2C_PENDING)
+    {
+    }
+    return transaction->status;
+
+} /* i2c_wait */
+
+uint8_t i2c_busy(void)
+{
+    return i2c_running;
+}
+
+/*************************************************************************
+ Wait until the engine has emptied the queue and released the bus
+*************************************************************************/
+void i2c_flush(void)
+{
+    while (i2c_running)
+    {
+    }
+    i2c_waitStop();
+
+} /* i2c_flush */
+
+/*************************************************************************
+ Finish the transaction on the bus and continue with the next one,
+ a STOP followed by a START is issued if the queue is not empty
+*************************************************************************/
+static void i2c_finish(uint8_t status)
+{
+    uint8_t tail = i2c_queue_tail;
+
+    i2c_queue[tail]->status = status;
+    I2C_COUNT(transactions);
+    tail = (tail + 1) & (I2C_QUEUE_SIZE - 1);
+    i2c_queue_tail = tail;
+    i2c_index = 0;
+
+    if (tail != i2c_queue_head)
+    {
+        TWCR = I2C_TWCR_RESTART;
+    }
+    else
+    {
+        TWCR = I2C_TWCR_STOP;
+        i2c_running = 0;
+    }
+}
+
+/*************************************************************************
+ TWI state machine, one step per bus event
+*************************************************************************/
+ISR(TWI_vect)
+{
+    I2cTransaction *transaction = i2c_queue[i2c_queue_tail];
+
+    switch (TW_STATUS & 0xF8)
+    {
+    case TW_START:
+    case TW_REP_START:
+        TWDR = transaction->address;
+        TWCR = I2C_TWCR_NEXT;
+        I2C_COUNT(bytes);
+        break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (i2c_index < transaction->length)
+        {
+            TWDR = transaction->buffer[i2c_index++];
+            TWCR = I2C_TWCR_NEXT;
+            I2C_COUNT(bytes);
+        }
+        else
+        {
+            i2c_finish(I2C_DONE);
+        }
+        break;
+
+    case TW_MR_DATA_ACK:
+        transaction->buffer[i2c_index++] = TWDR;
+        I2C_COUNT(bytes);
+        /* fall through */
+    case TW_MR_SLA_ACK:
+        if (i2c_index + 1 < transaction->length)
+            TWCR = I2C_TWCR_ACK;
+        else
+            TWCR = I2C_TWCR_NEXT; // NACK the last byte
+        break;
+
+    case TW_MR_DATA_NACK:
+        transaction->buffer[i2c_index++] = TWDR;
+        I2C_COUNT(bytes);
+        i2c_finish(I2C_DONE);
+        break;
+
+    default: // address or data NACK, arbitration lost, bus error
+        i2c_finish(I2C_ERROR);
+        break;
+    }
+}
+
 /*************************************************************************
   Issues a start condition and sends address and transfer direction.
   return 0 = device accessible, 1= failed to access device
@@ -60,6 +263,9 @@ unsigned char i2c_start(unsigned char address)
 {
     uint8_t twst;
 
+    // the interrupt driven engine owns the bus until its queue is empty
+    i2c_flush();
+
     // send START condition
     TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
 
@@ -100,6 +306,10 @@ uint8_t i2c_start_wait(unsigned char address)
     uint8_t twst;
 
     int retry = 2000;
+
+    // the interrupt driven engine owns the bus until its queue is empty
+    i2c_flush();
+
     while (1)
     {
         // send START condition
@@ -197,6 +407,24 @@ unsigned char i2c_write(unsigned char data)
 
 } /* i2c_write */
 
+/*************************************************************************
+  Send a series of bytes to the previously addressed I2C device
+
+  Input:    bytes to be transfered and their number
+  Return:   0 write successful
+            1 write failed
+*************************************************************************/
+unsigned char i2c_write_buf(const uint8_t *data, uint8_t length)
+{
+    while (length--)
+    {
+        if (i2c_write(*data++))
+            return 1;
+    }
+    return 0;
+
+} /* i2c_write_buf */
+
 /*************************************************************************
  Read one byte from the I2C device, request more data from device
 
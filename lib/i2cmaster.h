@@ -98,13 +98,45 @@ extern "C"
 /** defines the data direction (writing to I2C device) in i2c_start(),i2c_rep_start() */
 #define I2C_WRITE 0
 
+/** standard mode SCL frequency in Hz */
+#define I2C_SPEED_STANDARD 100000UL
+
+/** fast mode SCL frequency in Hz */
+#define I2C_SPEED_FAST 400000UL
+
+    /**
+     @brief bit rate settings applied by the last i2c_init()/i2c_init_speed()
+     */
+    typedef struct
+    {
+        uint32_t scl; /**< achieved SCL frequency in Hz */
+        uint8_t twbr; /**< bit rate register value */
+        uint8_t twps; /**< prescaler bits, prescaler = 4^twps */
+    } I2cTiming;
+
+    extern I2cTiming i2c_timing;
+
     /**
      @brief initialize the I2C master interace. Need to be called only once
+
+     Uses the compile time I2C_SCL_CLOCK with prescaler 1.
      @param  void
      @return none
      */
     extern void i2c_init(void);
 
+    /**
+     @brief initialize the I2C master interface for a given bus speed
+
+     TWBR is rounded up so the bus never runs faster than requested.
+     The achieved values are stored in i2c_timing.
+     @param    scl SCL frequency in Hz, e.g. I2C_SPEED_STANDARD or I2C_SPEED_FAST
+     @param    prescaler TWPS bits 0..3 (prescaler 1, 4, 16 or 64)
+     @retval   0 bus configured
+     @retval   1 speed not reachable with TWBR > 10 and TWBR <= 255, bus unchanged
+     */
+    extern uint8_t i2c_init_speed(uint32_t scl, uint8_t prescaler);
+
     /**
      @brief Terminates the data transfer and releases the I2C bus
      @param void
@@ -147,6 +179,15 @@ extern "C"
      */
     extern unsigned char i2c_write(unsigned char data);
 
+    /**
+     @brief Send a series of bytes to the I2C device addressed by i2c_start()
+     @param    data  bytes to be transfered
+     @param    length number of bytes
+     @retval   0 write successful
+     @retval   1 write failed, remaining bytes not sent
+     */
+    extern unsigned char i2c_write_buf(const uint8_t *data, uint8_t length);
+
     /**
      @brief    read one byte from the I2C device, request more data from device
      @return   byte read from I2C device
@@ -171,6 +212,76 @@ extern "C"
     extern unsigned char i2c_read(unsigned char ack);
 #define i2c_read(ack) (ack) ? i2c_readAck() : i2c_readNak();
 
+/** transaction is queued or on the bus */
+#define I2C_PENDING 0
+
+/** transaction completed, all bytes acknowledged */
+#define I2C_DONE 1
+
+/** transaction aborted, device did not acknowledge or arbitration was lost */
+#define I2C_ERROR 2
+
+/** number of transactions the interrupt driven engine can hold, must be a power of 2 */
+#define I2C_QUEUE_SIZE 8
+
+    /**
+     @brief transaction handled by the interrupt driven TWI engine
+
+     The engine only keeps a pointer to the transaction, so the transaction and
+     its buffer must stay valid until status is no longer I2C_PENDING.
+     */
+    typedef struct
+    {
+        uint8_t address;        /**< device address and transfer direction (I2C_READ/I2C_WRITE) */
+        uint8_t *buffer;        /**< bytes to send or storage for bytes received */
+        uint8_t length;         /**< number of bytes to transfer */
+        volatile uint8_t status; /**< I2C_PENDING, I2C_DONE or I2C_ERROR */
+    } I2cTransaction;
+
+#ifdef I2C_STATS
+    /**
+     @brief bus traffic of the interrupt driven engine, for benchmarking
+     */
+    typedef struct
+    {
+        uint32_t bytes;        /**< address and data bytes on the wire */
+        uint32_t transactions; /**< START ... STOP sequences */
+    } I2cStats;
+
+    extern volatile I2cStats i2c_stats;
+#endif
+
+    /**
+     @brief Queue a transaction, it is executed in the background by TWI_vect
+
+     A write sends START, address, all bytes and STOP. A read NACKs the last byte.
+     Must not be used while a blocking i2c_start() ... i2c_stop() sequence is open.
+     @param    transaction transaction to execute, status is set to I2C_PENDING
+     @retval   0 transaction queued
+     @retval   1 queue full, transaction not queued
+     */
+    extern uint8_t i2c_submit(I2cTransaction *transaction);
+
+    /**
+     @brief    Wait until a queued transaction is finished
+     @param    transaction transaction passed to i2c_submit()
+     @return   I2C_DONE or I2C_ERROR
+     */
+    extern uint8_t i2c_wait(I2cTransaction *transaction);
+
+    /**
+     @brief    Check if the interrupt driven engine is still working on the queue
+     @retval   0 idle, the blocking functions can be used
+     @retval   1 busy
+     */
+    extern uint8_t i2c_busy(void);
+
+    /**
+     @brief    Wait until all queued transactions are finished
+     @return   none
+     */
+    extern void i2c_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
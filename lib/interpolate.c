@@ -0,0 +1,101 @@
+/*
+interpolate lib 0x01
+
+Bresenham / DDA straight line interpolation, no divisions so it is
+cheap enough for every control tick.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "interpolate.h"
+
+void interpolate_init(Interpolator *line, uint8_t axes, const int32_t *position)
+{
+    line->axes = axes > INTERPOLATE_AXES_MAX ? INTERPOLATE_AXES_MAX : axes;
+    interpolate_reset(line, position);
+}
+
+/*
+ * stand still at position
+ */
+void interpolate_reset(Interpolator *line, const int32_t *position)
+{
+    for (uint8_t i = 0; i < line->axes; i++)
+    {
+        line->position[i] = position[i];
+        line->delta[i] = 0;
+        line->direction[i] = 0;
+        line->error[i] = 0;
+    }
+    line->length = 0;
+    line->path = 0;
+}
+
+/*
+ * start a line from the current setpoints to target
+ * returns the path length, the distance of the longest axis
+ */
+int32_t interpolate_start(Interpolator *line, const int32_t *target)
+{
+    line->length = 0;
+    line->path = 0;
+    for (uint8_t i = 0; i < line->axes; i++)
+    {
+        int32_t delta = target[i] - line->position[i];
+
+        line->direction[i] = delta < 0 ? -1 : 1;
+        line->delta[i] = delta < 0 ? -delta : delta;
+        line->error[i] = 0;
+        if (line->delta[i] > line->length)
+            line->length = line->delta[i];
+    }
+    return line->length;
+}
+
+/*
+ * move the setpoints to path (0..length), one Bresenham step per count
+ * of the longest axis, backwards as well when the path went back
+ */
+void interpolate_update(Interpolator *line, int32_t path)
+{
+    if (path < 0)
+        path = 0;
+    else if (path > line->length)
+        path = line->length;
+
+    while (line->path < path)
+    {
+        line->path++;
+        for (uint8_t i = 0; i < line->axes; i++)
+        {
+            line->error[i] += line->delta[i];
+            if (2 * line->error[i] > line->length)
+            {
+                line->position[i] += line->direction[i];
+                line->error[i] -= line->length;
+            }
+        }
+    }
+    while (line->path > path)
+    {
+        line->path--;
+        for (uint8_t i = 0; i < line->axes; i++)
+        {
+            line->error[i] -= line->delta[i];
+            if (2 * line->error[i] <= -line->length)
+            {
+                line->position[i] -= line->direction[i];
+                line->error[i] += line->length;
+            }
+        }
+    }
+}
+
+/*
+ * true when the setpoints are at the end of the line
+ */
+uint8_t interpolate_done(Interpolator *line)
+{
+    return line->path == line->length;
+}
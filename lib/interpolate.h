@@ -0,0 +1,32 @@
+#ifndef INTERPOLATE_H
+#define INTERPOLATE_H
+
+#include <inttypes.h>
+
+/*
+ * Straight line interpolation (Bresenham / DDA) over up to
+ * INTERPOLATE_AXES_MAX axes. The move is driven by one path position,
+ * 0..length counts of the longest axis, the other axes follow it with
+ * integer error terms so every axis arrives at the same time and the
+ * line is never more than half a count off.
+ */
+#define INTERPOLATE_AXES_MAX 3
+
+typedef struct
+{
+    uint8_t axes;
+    int32_t position[INTERPOLATE_AXES_MAX]; // setpoints on the line, counts
+    int32_t delta[INTERPOLATE_AXES_MAX];    // distance of the move, counts
+    int8_t direction[INTERPOLATE_AXES_MAX];
+    int32_t error[INTERPOLATE_AXES_MAX];    // Bresenham error, -length/2..length/2
+    int32_t length;                         // distance of the longest axis
+    int32_t path;                           // path position reached, 0..length
+} Interpolator;
+
+extern void interpolate_init(Interpolator *line, uint8_t axes, const int32_t *position);
+extern void interpolate_reset(Interpolator *line, const int32_t *position);
+extern int32_t interpolate_start(Interpolator *line, const int32_t *target);
+extern void interpolate_update(Interpolator *line, int32_t path);
+extern uint8_t interpolate_done(Interpolator *line);
+
+#endif
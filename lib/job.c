@@ -0,0 +1,215 @@
+/*
+job lib 0x01
+
+Orders the box transfers of a multi-cell grid run for a short run
+(nearest neighbour and 2-opt).
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "job.h"
+
+#define JOB_HOME 0xFF // index of the home position in a run
+
+// centre of a cell in counts
+static void job_position(Grid *grid, const JobCell *cell, int32_t *x, int32_t *y)
+{
+    *x = grid->column[cell->column];
+    *y = grid->row[cell->row];
+}
+
+static uint32_t job_chebyshev(int32_t x, int32_t y)
+{
+    if (x < 0)
+        x = -x;
+    if (y < 0)
+        y = -y;
+    return x > y ? x : y;
+}
+
+/*
+ * travel from the to cell of a move (or home) to the from cell of the
+ * next move (or home)
+ */
+static uint32_t job_distance(Job *job, Grid *grid, uint8_t from, uint8_t to)
+{
+    int32_t x = 0, y = 0;
+    int32_t toX = 0, toY = 0;
+
+    if (from != JOB_HOME)
+        job_position(grid, &job->moves[from].to, &x, &y);
+    if (to != JOB_HOME)
+        job_position(grid, &job->moves[to].from, &toX, &toY);
+    return job_chebyshev(x - toX, y - toY);
+}
+
+// move at position i of the run, home before the first and after the last
+static uint8_t job_stop(Job *job, int8_t i)
+{
+    return i < 0 || i >= job->count ? JOB_HOME : job->order[i];
+}
+
+static uint32_t job_length(Job *job, Grid *grid)
+{
+    uint32_t length = 0;
+
+    for (int8_t i = 0; i <= job->count; i++)
+    {
+        length += job_distance(job, grid, job_stop(job, i - 1), job_stop(job, i));
+    }
+    // carrying the boxes, the same in every order
+    for (uint8_t i = 0; i < job->count; i++)
+    {
+        int32_t x, y, toX, toY;
+        job_position(grid, &job->moves[i].from, &x, &y);
+        job_position(grid, &job->moves[i].to, &toX, &toY);
+        length += job_chebyshev(x - toX, y - toY);
+    }
+    return length;
+}
+
+void job_clear(Job *job)
+{
+    job->count = 0;
+    job->next = 0;
+    job->naive = 0;
+    job->planned = 0;
+}
+
+/*
+ * true when a move of the job picks up from or puts down in the cell
+ */
+uint8_t job_uses(Job *job, uint8_t column, uint8_t row)
+{
+    for (uint8_t i = 0; i < job->count; i++)
+    {
+        JobMove *move = &job->moves[i];
+        if ((move->from.column == column && move->from.row == row) ||
+            (move->to.column == column && move->to.row == row))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * add the transfer of a box from one cell to another
+ * returns 0 when the job is full, a cell is outside the grid, both cells
+ * are the same or a cell is already used by the job
+ */
+uint8_t job_add(Job *job, Grid *grid, const JobCell *from, const JobCell *to)
+{
+    if (job->count >= JOB_MOVES_MAX)
+        return 0;
+    if (from->column >= grid->columns || from->row >= grid->rows ||
+        to->column >= grid->columns || to->row >= grid->rows)
+        return 0;
+    if ((from->column == to->column && from->row == to->row) ||
+        job_uses(job, from->column, from->row) || job_uses(job, to->column, to->row))
+        return 0;
+
+    job->moves[job->count].from = *from;
+    job->moves[job->count].to = *to;
+    job->order[job->count] = job->count;
+    job->count++;
+    return 1;
+}
+
+/*
+ * order the moves for a short run from home and back, the cells have to
+ * be inside the grid the job was built for
+ */
+void job_plan(Job *job, Grid *grid)
+{
+    uint8_t n = job->count;
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        job->order[i] = i;
+    }
+    job->naive = job_length(job, grid);
+
+    // nearest neighbour: always pick up the closest box not moved yet
+    for (uint8_t i = 0; i < n; i++)
+    {
+        uint8_t from = job_stop(job, i - 1);
+        uint8_t best = i;
+        uint32_t bestDistance = job_distance(job, grid, from, job->order[i]);
+
+        for (uint8_t j = i + 1; j < n; j++)
+        {
+            uint32_t distance = job_distance(job, grid, from, job->order[j]);
+            if (distance < bestDistance)
+            {
+                best = j;
+                bestDistance = distance;
+            }
+        }
+        uint8_t move = job->order[i];
+        job->order[i] = job->order[best];
+        job->order[best] = move;
+    }
+
+    // 2-opt: reverse order[i..j] when the run gets shorter
+    for (uint8_t pass = 0; pass < JOB_PASSES_MAX; pass++)
+    {
+        uint8_t improved = 0;
+
+        for (uint8_t i = 0; i + 1 < n; i++)
+        {
+            int32_t inside = 0; // change of the legs inside order[i..j] when it is reversed
+
+            for (uint8_t j = i + 1; j < n; j++)
+            {
+                uint8_t a = job_stop(job, i - 1);
+                uint8_t b = job->order[i];
+                uint8_t c = job->order[j];
+                uint8_t d = job_stop(job, j + 1);
+
+                inside += (int32_t)job_distance(job, grid, c, job->order[j - 1]) -
+                          (int32_t)job_distance(job, grid, job->order[j - 1], c);
+                if ((int32_t)(job_distance(job, grid, a, c) + job_distance(job, grid, b, d)) + inside <
+                    (int32_t)(job_distance(job, grid, a, b) + job_distance(job, grid, c, d)))
+                {
+                    for (uint8_t lo = i, hi = j; lo < hi; lo++, hi--)
+                    {
+                        uint8_t move = job->order[lo];
+                        job->order[lo] = job->order[hi];
+                        job->order[hi] = move;
+                    }
+                    inside = -inside; // reversing it back would undo the change
+                    improved = 1;
+                }
+            }
+        }
+        if (!improved)
+            break;
+    }
+
+    job->planned = job_length(job, grid);
+    if (job->planned > job->naive)
+    {
+        // the heuristics can miss, the order added is kept then
+        for (uint8_t i = 0; i < n; i++)
+        {
+            job->order[i] = i;
+        }
+        job->planned = job->naive;
+    }
+    job->next = 0;
+}
+
+/*
+ * next cell of the planned run, the from and the to cell of every move
+ * returns 0 when the job is done
+ */
+uint8_t job_next(Job *job, JobCell *cell)
+{
+    if (job->next >= 2 * job->count)
+        return 0;
+
+    JobMove *move = &job->moves[job->order[job->next >> 1]];
+    *cell = job->next & 1 ? move->to : move->from;
+    job->next++;
+    return 1;
+}
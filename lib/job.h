@@ -0,0 +1,56 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <inttypes.h>
+#include "grid.h"
+
+/*
+ * A job moves boxes from one grid cell to another, starting and ending at
+ * home (0, 0). Every transfer picks the box up in its from cell and puts
+ * it down in its to cell, a cell is used only once in a job so the order
+ * of the transfers is free.
+ *
+ * job_plan() orders the transfers for a short run: nearest neighbour
+ * first, then 2-opt passes that reverse a part of the order while that
+ * makes it shorter. The cost of a run is the travel home -> from, from ->
+ * to of every transfer, to -> from of the next one and the last to ->
+ * home. Only the legs between the transfers depend on the order, they are
+ * not symmetric, so a reversal also counts the legs inside the reversed
+ * part. Distances are the Chebyshev distance in counts, X and Y move at
+ * the same time so the longer axis sets the travel time.
+ *
+ * Work and memory are bounded: at most JOB_MOVES_MAX transfers and
+ * JOB_PASSES_MAX 2-opt passes of n^2 / 2 tests each.
+ */
+#define JOB_MOVES_MAX 16
+#define JOB_PASSES_MAX 8
+
+typedef struct
+{
+    uint8_t column;
+    uint8_t row;
+} JobCell;
+
+typedef struct
+{
+    JobCell from; // cell the box is picked up from
+    JobCell to;   // cell the box is put down in
+} JobMove;
+
+typedef struct
+{
+    JobMove moves[JOB_MOVES_MAX];  // in the order they were added
+    uint8_t order[JOB_MOVES_MAX];  // planned run, indices into moves
+    uint8_t count;
+    uint8_t next;                  // next cell to visit, two per move
+    uint32_t naive;                // travel in the order added, counts
+    uint32_t planned;              // travel in the planned order, counts
+} Job;
+
+extern void job_clear(Job *job);
+extern uint8_t job_uses(Job *job, uint8_t column, uint8_t row);
+extern uint8_t job_add(Job *job, Grid *grid, const JobCell *from, const JobCell *to);
+extern void job_plan(Job *job, Grid *grid);
+extern uint8_t job_next(Job *job, JobCell *cell);
+
+#endif
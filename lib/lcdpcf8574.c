@@ -12,6 +12,7 @@ Please refer to LICENSE file for licensing information.
 #include <avr/pgmspace.h>
 
 #include "pcf8574.h"
+#include "systick.h"
 
 #include "lcdpcf8574.h"
 
@@ -26,6 +27,25 @@ Please refer to LICENSE file for licensing information.
 
 volatile uint8_t dataport = 0;
 
+#if LCD_USE_BUSYFLAG == 0
+static uint16_t lcd_busysince = 0; // timestamp of the last clear/home instruction
+static uint8_t lcd_busy = 0;        // clear/home instruction may still be executing
+static uint8_t lcd_address = 0;     // address counter, tracked instead of read back
+#endif
+
+#if LCD_FRAMEBUFFER
+static char lcd_framebuffer[LCD_LINES][LCD_DISP_LENGTH]; // content drawn by lcd_putc()
+static char lcd_screen[LCD_LINES][LCD_DISP_LENGTH];      // content on the display
+static uint8_t lcd_x = 0;                                 // framebuffer cursor
+static uint8_t lcd_y = 0;
+static uint8_t lcd_cursorx = 0xFF; // display cursor, 0xFF when unknown
+static uint8_t lcd_cursory = 0xFF;
+static uint8_t lcd_pumpcell = 0;    // cell lcd_pump() continues with
+static uint16_t lcd_pumpworst = 0;  // longest lcd_pump() call in systick ticks
+
+static const uint8_t lcd_linestart[] = {LCD_START_LINE1, LCD_START_LINE2, LCD_START_LINE3, LCD_START_LINE4};
+#endif
+
 /*
 ** function prototypes
 */
@@ -127,8 +147,31 @@ static void toggle_e(void)
     pcf8574_setoutputpinlow(LCD_PCF8574_DEVICEID, LCD_E_PIN);
 }
 
+/*************************************************************************
+Map the low nibble of a byte to the data pins of the port
+*************************************************************************/
+static uint8_t lcd_nibble(uint8_t port, uint8_t nibble)
+{
+    port &= ~(_BV(LCD_DATA0_PIN) | _BV(LCD_DATA1_PIN) | _BV(LCD_DATA2_PIN) | _BV(LCD_DATA3_PIN));
+    if (nibble & 0x08)
+        port |= _BV(LCD_DATA3_PIN);
+    if (nibble & 0x04)
+        port |= _BV(LCD_DATA2_PIN);
+    if (nibble & 0x02)
+        port |= _BV(LCD_DATA1_PIN);
+    if (nibble & 0x01)
+        port |= _BV(LCD_DATA0_PIN);
+    return port;
+}
+
 /*************************************************************************
 Low-level function to write byte to LCD controller
+The RS/data/E states are sent as one PCF8574 burst, every I2C byte lasts
+longer than the HD44780 setup and pulse width times:
+  high nibble, E high, E low, low nibble + E high, E low, data pins high
+Per character this is 1 address + 6 data bytes on the wire, the former
+8 single-byte transactions needed 16 bytes and 8 START/STOP pairs
+(about 0.7 ms instead of 1.7 ms of bus time at 100 kHz).
 Input:    data   byte to write to LCD
           rs     1: write data
                  0: write instruction
@@ -136,55 +179,82 @@ Returns:  none
 *************************************************************************/
 static void lcd_write(uint8_t data, uint8_t rs)
 {
+    uint8_t sequence[6];
+
     if (rs) /* write data        (RS=1, RW=0) */
         dataport |= _BV(LCD_RS_PIN);
     else /* write instruction (RS=0, RW=0) */
         dataport &= ~_BV(LCD_RS_PIN);
     dataport &= ~_BV(LCD_RW_PIN);
-    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
 
     /* output high nibble first */
-    dataport &= ~_BV(LCD_DATA3_PIN);
-    dataport &= ~_BV(LCD_DATA2_PIN);
-    dataport &= ~_BV(LCD_DATA1_PIN);
-    dataport &= ~_BV(LCD_DATA0_PIN);
-    if (data & 0x80)
-        dataport |= _BV(LCD_DATA3_PIN);
-    if (data & 0x40)
-        dataport |= _BV(LCD_DATA2_PIN);
-    if (data & 0x20)
-        dataport |= _BV(LCD_DATA1_PIN);
-    if (data & 0x10)
-        dataport |= _BV(LCD_DATA0_PIN);
-    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
-    lcd_e_toggle();
+    sequence[0] = lcd_nibble(dataport, data >> 4);
+    sequence[1] = sequence[0] | _BV(LCD_E_PIN);
+    sequence[2] = sequence[0];
 
     /* output low nibble */
-    dataport &= ~_BV(LCD_DATA3_PIN);
-    dataport &= ~_BV(LCD_DATA2_PIN);
-    dataport &= ~_BV(LCD_DATA1_PIN);
-    dataport &= ~_BV(LCD_DATA0_PIN);
-    if (data & 0x08)
-        dataport |= _BV(LCD_DATA3_PIN);
-    if (data & 0x04)
-        dataport |= _BV(LCD_DATA2_PIN);
-    if (data & 0x02)
-        dataport |= _BV(LCD_DATA1_PIN);
-    if (data & 0x01)
-        dataport |= _BV(LCD_DATA0_PIN);
-    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
-    lcd_e_toggle();
+    sequence[4] = lcd_nibble(dataport, data);
+    sequence[3] = sequence[4] | _BV(LCD_E_PIN);
 
+#if LCD_USE_BUSYFLAG
     /* all data pins high (inactive) */
     dataport |= _BV(LCD_DATA0_PIN);
     dataport |= _BV(LCD_DATA1_PIN);
     dataport |= _BV(LCD_DATA2_PIN);
     dataport |= _BV(LCD_DATA3_PIN);
-    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
+    sequence[5] = dataport;
+
+    pcf8574_write_sequence(LCD_PCF8574_DEVICEID, sequence, sizeof(sequence));
+#else
+    /* the pins are never read back, leave the low nibble on the port */
+    dataport = sequence[4];
+    pcf8574_write_sequence(LCD_PCF8574_DEVICEID, sequence, sizeof(sequence) - 1);
+
+    /*
+     * Other instructions take 37 us, the next E strobe is at least two I2C
+     * bytes (45 us at 400 kHz) behind. Clear display and return home take
+     * longer, count their execution time from the moment they left the bus.
+     */
+    if (rs)
+    {
+        lcd_address++;
+    }
+    else if (data & (1 << LCD_DDRAM))
+    {
+        lcd_address = data & ~(1 << LCD_DDRAM);
+    }
+    else if (data == (1 << LCD_CLR) || (data & ~1) == (1 << LCD_HOME))
+    {
+        lcd_address = 0;
+        pcf8574_flush();
+        lcd_busysince = systick_now();
+        lcd_busy = 1;
+    }
+#endif
+}
+
+/*************************************************************************
+Sample the data pins once and return them as low nibble
+*************************************************************************/
+static uint8_t lcd_input(void)
+{
+    uint8_t port = ~pcf8574_getinput(LCD_PCF8574_DEVICEID); // undo the inversion of getinput
+    uint8_t nibble = 0;
+    if (port & _BV(LCD_DATA0_PIN))
+        nibble |= 0x01;
+    if (port & _BV(LCD_DATA1_PIN))
+        nibble |= 0x02;
+    if (port & _BV(LCD_DATA2_PIN))
+        nibble |= 0x04;
+    if (port & _BV(LCD_DATA3_PIN))
+        nibble |= 0x08;
+    return nibble;
 }
 
 /*************************************************************************
 Low-level function to read byte from LCD controller
+The port is read once per nibble, E is raised in the same burst that
+sets RS/RW so a byte costs 3 writes and 2 reads on the bus.
 Input:    rs     1: read data
                  0: read busy flag / address counter
 Returns:  byte read from LCD controller
@@ -192,43 +262,30 @@ Returns:  byte read from LCD controller
 static uint8_t lcd_read(uint8_t rs)
 {
     uint8_t data;
+    uint8_t sequence[2];
 
-    if (rs) /* write data (RS=1, RW=0) */
+    if (rs) /* read data (RS=1, RW=1) */
         dataport |= _BV(LCD_RS_PIN);
-    else /* write instruction (RS=0, RW=0) */
+    else /* read instruction (RS=0, RW=1) */
         dataport &= ~_BV(LCD_RS_PIN);
     dataport |= _BV(LCD_RW_PIN);
-    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
 
-    /* read high nibble first */
-    pcf8574_setoutputpinhigh(LCD_PCF8574_DEVICEID, LCD_E_PIN);
-    lcd_e_delay();
-    data = 0;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA0_PIN))
-        data |= 0x10;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA1_PIN))
-        data |= 0x20;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA2_PIN))
-        data |= 0x40;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA3_PIN))
-        data |= 0x80;
-    pcf8574_setoutputpinlow(LCD_PCF8574_DEVICEID, LCD_E_PIN);
-
-    /* Enable 500ns low */
-    lcd_e_delay();
+    /* data pins high, so the PCF8574 can read them */
+    dataport |= _BV(LCD_DATA0_PIN);
+    dataport |= _BV(LCD_DATA1_PIN);
+    dataport |= _BV(LCD_DATA2_PIN);
+    dataport |= _BV(LCD_DATA3_PIN);
 
-    /* read low nibble */
-    pcf8574_setoutputpinhigh(LCD_PCF8574_DEVICEID, LCD_E_PIN);
-    lcd_e_delay();
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA0_PIN))
-        data |= 0x01;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA1_PIN))
-        data |= 0x02;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA2_PIN))
-        data |= 0x04;
-    if (!pcf8574_getinputpin(LCD_PCF8574_DEVICEID, LCD_DATA3_PIN))
-        data |= 0x08;
-    pcf8574_setoutputpinlow(LCD_PCF8574_DEVICEID, LCD_E_PIN);
+    /* read high nibble first */
+    sequence[0] = dataport;
+    sequence[1] = dataport | _BV(LCD_E_PIN);
+    pcf8574_write_sequence(LCD_PCF8574_DEVICEID, sequence, sizeof(sequence));
+    data = lcd_input() << 4;
+
+    /* Enable low for one I2C byte, then read low nibble */
+    pcf8574_write_sequence(LCD_PCF8574_DEVICEID, sequence, sizeof(sequence));
+    data |= lcd_input();
+    pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
 
     return data;
 }
@@ -238,6 +295,17 @@ loops while lcd is busy, returns address counter
 *************************************************************************/
 static uint8_t lcd_waitbusy(void)
 {
+#if LCD_USE_BUSYFLAG == 0
+    /* wait until the last clear/home instruction is executed */
+    if (lcd_busy)
+    {
+        while (systick_since(lcd_busysince) < SYSTICK_US(LCD_DELAY_CLEAR_US))
+        {
+        }
+        lcd_busy = 0;
+    }
+    return lcd_address;
+#else
     register uint8_t c;
 
     /* wait until busy flag is cleared */
@@ -250,6 +318,7 @@ static uint8_t lcd_waitbusy(void)
 
     /* now read the address counter */
     return (lcd_read(0)); // return address counter
+#endif
 
 } /* lcd_waitbusy */
 
@@ -297,6 +366,9 @@ void lcd_command(uint8_t cmd)
 {
     lcd_waitbusy();
     lcd_write(cmd, 0);
+#if LCD_FRAMEBUFFER
+    lcd_cursory = 0xFF; // lcd_flush() has to position the cursor again
+#endif
 }
 
 /*************************************************************************
@@ -319,7 +391,7 @@ void lcd_clear_CGRAM()
     for (; addressCounter < 64; addressCounter++)
     {
         lcd_command((1 << LCD_CGRAM) + addressCounter);
-        lcd_putc(0x00);
+        lcd_data(0x00);
     }
 }
 
@@ -342,7 +414,7 @@ uint8_t lcd_create_custom_char(uint8_t charnum, const uint8_t *values)
     lcd_command((1 << LCD_CGRAM) + charnum * 8); // set CGRAM address charnum * 8 byte
     for (; j < 8; j++)
     {
-        lcd_putc(*(p + j)); // write 8 byte data (one character) to CGRAM
+        lcd_data(*(p + j)); // write 8 byte data (one character) to CGRAM
     }
     return (0);
 }
@@ -355,16 +427,17 @@ Returns:  none
 *************************************************************************/
 void lcd_gotoxy(uint8_t x, uint8_t y)
 {
-#if LCD_LINES == 1
+#if LCD_FRAMEBUFFER
+    lcd_x = x;
+    lcd_y = y < LCD_LINES ? y : LCD_LINES - 1;
+#elif LCD_LINES == 1
     lcd_command((1 << LCD_DDRAM) + LCD_START_LINE1 + x);
-#endif
-#if LCD_LINES == 2
+#elif LCD_LINES == 2
     if (y == 0)
         lcd_command((1 << LCD_DDRAM) + LCD_START_LINE1 + x);
     else
         lcd_command((1 << LCD_DDRAM) + LCD_START_LINE2 + x);
-#endif
-#if LCD_LINES == 4
+#elif LCD_LINES == 4
     if (y == 0)
         lcd_command((1 << LCD_DDRAM) + LCD_START_LINE1 + x);
     else if (y == 1)
@@ -384,12 +457,47 @@ int lcd_getxy(void)
     return lcd_waitbusy();
 }
 
+/*************************************************************************
+Read a block of display data RAM
+Input:    address  DDRAM address of the first character
+          buffer   storage for length characters
+          length   number of characters to read
+Returns:  none
+*************************************************************************/
+void lcd_read_block(uint8_t address, uint8_t *buffer, uint8_t length)
+{
+    lcd_command((1 << LCD_DDRAM) + address);
+    lcd_waitbusy();
+
+    /* the address counter advances in 4 us, less than one read on the bus */
+    while (length--)
+    {
+        *buffer++ = lcd_read(1);
+#if LCD_USE_BUSYFLAG == 0
+        lcd_address++;
+#endif
+    }
+
+} /* lcd_read_block */
+
 /*************************************************************************
 Clear display and set cursor to home position
 *************************************************************************/
 void lcd_clrscr(void)
 {
+#if LCD_FRAMEBUFFER
+    for (uint8_t y = 0; y < LCD_LINES; y++)
+    {
+        for (uint8_t x = 0; x < LCD_DISP_LENGTH; x++)
+        {
+            lcd_framebuffer[y][x] = ' ';
+        }
+    }
+    lcd_x = 0;
+    lcd_y = 0;
+#else
     lcd_command(1 << LCD_CLR);
+#endif
 }
 
 /*************************************************************************
@@ -409,9 +517,102 @@ Set cursor to home position
 *************************************************************************/
 void lcd_home(void)
 {
+#if LCD_FRAMEBUFFER
+    lcd_x = 0;
+    lcd_y = 0;
+#else
     lcd_command(1 << LCD_HOME);
+#endif
+}
+
+#if LCD_FRAMEBUFFER
+/*************************************************************************
+Send up to <cells> framebuffer cells that differ from the display,
+starting behind the last cell sent. The cursor is only positioned when
+the changed cell is not the adjacent one.
+Returns:  number of cells sent
+*************************************************************************/
+static uint8_t lcd_update(uint8_t cells)
+{
+    uint8_t sent = 0;
+
+    for (uint8_t i = 0; i < LCD_LINES * LCD_DISP_LENGTH && sent < cells; i++)
+    {
+        uint8_t y = lcd_pumpcell / LCD_DISP_LENGTH;
+        uint8_t x = lcd_pumpcell % LCD_DISP_LENGTH;
+        char c = lcd_framebuffer[y][x];
+
+        if (++lcd_pumpcell == LCD_LINES * LCD_DISP_LENGTH)
+            lcd_pumpcell = 0;
+        if (c == lcd_screen[y][x])
+            continue;
+
+        if (x != lcd_cursorx || y != lcd_cursory)
+            lcd_command((1 << LCD_DDRAM) + lcd_linestart[y] + x);
+        lcd_data(c);
+        lcd_screen[y][x] = c;
+        lcd_cursorx = x + 1;
+        lcd_cursory = y;
+        sent++;
+    }
+    return sent;
+}
+
+/*************************************************************************
+Send all framebuffer cells that differ from the display
+*************************************************************************/
+void lcd_flush(void)
+{
+    lcd_update(LCD_LINES * LCD_DISP_LENGTH);
+}
+
+/*************************************************************************
+Send a bounded number of changed cells, meant to be called periodically.
+Nothing is sent while the previous cells are still on the bus, so with
+LCD_USE_BUSYFLAG 0 the call only queues writes and never waits.
+Input:    cells  maximum number of cells to send
+Returns:  number of cells sent
+*************************************************************************/
+uint8_t lcd_pump(uint8_t cells)
+{
+    uint16_t start = systick_now();
+    uint16_t elapsed;
+    uint8_t sent = 0;
+
+    if (!pcf8574_busy())
+    {
+        sent = lcd_update(cells);
+    }
+
+    elapsed = systick_since(start);
+    if (elapsed > lcd_pumpworst)
+        lcd_pumpworst = elapsed;
+    return sent;
 }
 
+/*************************************************************************
+Longest lcd_pump() call so far in systick ticks
+*************************************************************************/
+uint16_t lcd_pump_worst(void)
+{
+    return lcd_pumpworst;
+}
+#else
+void lcd_flush(void)
+{
+}
+
+uint8_t lcd_pump(uint8_t cells)
+{
+    return 0;
+}
+
+uint16_t lcd_pump_worst(void)
+{
+    return 0;
+}
+#endif
+
 /*************************************************************************
 Display character at current cursor position
 Input:    character to be displayed
@@ -419,6 +620,24 @@ Returns:  none
 *************************************************************************/
 void lcd_putc(char c)
 {
+#if LCD_FRAMEBUFFER
+    if (c == '\n')
+    {
+        lcd_x = 0;
+        lcd_y = (lcd_y + 1) % LCD_LINES;
+        return;
+    }
+    if (lcd_x >= LCD_DISP_LENGTH)
+    {
+#if LCD_WRAP_LINES == 1
+        lcd_x = 0;
+        lcd_y = (lcd_y + 1) % LCD_LINES;
+#else
+        return;
+#endif
+    }
+    lcd_framebuffer[lcd_y][lcd_x++] = c;
+#else
     uint8_t pos;
 
     pos = lcd_waitbusy(); // read busy-flag and address counter
@@ -465,6 +684,7 @@ void lcd_putc(char c)
 #endif
         lcd_write(c, 1);
     }
+#endif
 
 } /* lcd_putc */
 
@@ -532,10 +752,15 @@ void lcd_init(uint8_t dispAttr)
     pcf8574_init();
 #endif
 
+#if LCD_USE_BUSYFLAG == 0
+    systick_init();
+#endif
+
     dataport = 0;
     pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
 
-    delay(16000); /* wait 16ms or more after power-on       */
+    pcf8574_flush(); /* writes are queued, the delays count from the bus */
+    delay(16000);    /* wait 16ms or more after power-on       */
 
     /* initial write to lcd is 8bit */
     dataport |= _BV(LCD_DATA1_PIN); // _BV(LCD_FUNCTION)>>4;
@@ -543,20 +768,24 @@ void lcd_init(uint8_t dispAttr)
     pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
 
     lcd_e_toggle();
+    pcf8574_flush();
     delay(4992); /* delay, busy flag can't be checked here */
 
     /* repeat last command */
     lcd_e_toggle();
+    pcf8574_flush();
     delay(64); /* delay, busy flag can't be checked here */
 
     /* repeat last command a third time */
     lcd_e_toggle();
+    pcf8574_flush();
     delay(64); /* delay, busy flag can't be checked here */
 
     /* now configure for 4bit mode */
     dataport &= ~_BV(LCD_DATA0_PIN);
     pcf8574_setoutput(LCD_PCF8574_DEVICEID, dataport);
     lcd_e_toggle();
+    pcf8574_flush();
     delay(64); /* some displays need this additional delay */
 
     /* from now the LCD only accepts 4 bit I/O, we can use lcd_command() */
@@ -564,8 +793,20 @@ void lcd_init(uint8_t dispAttr)
     lcd_command(LCD_FUNCTION_DEFAULT); /* function set: display lines  */
 
     lcd_command(LCD_DISP_OFF);     /* display off                  */
-    lcd_clrscr();                  /* display clear                */
+    lcd_command(1 << LCD_CLR);     /* display clear                */
     lcd_command(LCD_MODE_DEFAULT); /* set entry mode               */
     lcd_command(dispAttr);         /* display/cursor control       */
 
+#if LCD_FRAMEBUFFER
+    /* the cleared display shows spaces */
+    lcd_clrscr();
+    for (uint8_t y = 0; y < LCD_LINES; y++)
+    {
+        for (uint8_t x = 0; x < LCD_DISP_LENGTH; x++)
+        {
+            lcd_screen[y][x] = ' ';
+        }
+    }
+#endif
+
 } /* lcd_init */
@@ -22,6 +22,24 @@ References:
 
 #define LCD_PCF8574_DEVICEID 7 // device id, addr = pcf8574 base addr + LCD_PCF8574_DEVICEID
 
+/**
+ * 1: poll the busy flag before every write
+ * 0: write only, wait the datasheet execution times using the systick timestamp
+ */
+#ifndef LCD_USE_BUSYFLAG
+#define LCD_USE_BUSYFLAG 1
+#endif
+
+#define LCD_DELAY_CLEAR_US 1640 /**< execution time of clear display / return home */
+
+/**
+ * 1: lcd_putc()/lcd_gotoxy()/lcd_clrscr() draw into a RAM framebuffer, lcd_flush() sends the changed cells
+ * 0: every call writes to the display
+ */
+#ifndef LCD_FRAMEBUFFER
+#define LCD_FRAMEBUFFER 1
+#endif
+
 /**
  *  @name  Definitions for Display Size
  *  Change these definitions to adapt setting to your display
@@ -135,6 +153,31 @@ extern void lcd_home(void);
 */
 extern void lcd_gotoxy(uint8_t x, uint8_t y);
 
+/**
+ @brief    Send the framebuffer cells that changed since the last flush
+
+ Does nothing when LCD_FRAMEBUFFER is 0.
+ @param    void
+ @return   none
+*/
+extern void lcd_flush(void);
+
+/**
+ @brief    Send a bounded number of changed framebuffer cells
+
+ Call it from a periodic slot to spread a screen update over several
+ ticks. With LCD_USE_BUSYFLAG 0 the call only queues I2C writes.
+ @param    cells maximum number of cells to send
+ @return   number of cells sent
+*/
+extern uint8_t lcd_pump(uint8_t cells);
+
+/**
+ @brief    Longest lcd_pump() call so far
+ @return   time in systick ticks, see SYSTICK_TICKS_PER_MS
+*/
+extern uint16_t lcd_pump_worst(void);
+
 /**
  @brief    Set illumination pin
  @param    void
@@ -187,6 +230,17 @@ extern void lcd_command(uint8_t cmd);
 */
 extern void lcd_data(uint8_t data);
 
+/**
+ @brief    Read characters from display data RAM in one pass
+
+ The cursor is left behind the last character read.
+ @param    address DDRAM address of the first character, e.g. LCD_START_LINE2
+ @param    buffer storage for the characters
+ @param    length number of characters to read
+ @return   none
+*/
+extern void lcd_read_block(uint8_t address, uint8_t *buffer, uint8_t length);
+
 /**
 @brief Clear CGRAM
 @param void
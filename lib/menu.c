@@ -0,0 +1,198 @@
+/*
+menu lib 0x01
+
+Table driven menu on the lcdpcf8574 display, nodes and labels are
+stored in program memory.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include <avr/pgmspace.h>
+#include "lcdpcf8574.h"
+#include "menu.h"
+
+#define MENU_COLUMNS (LCD_DISP_LENGTH / MENU_FIELD_WIDTH)
+
+static MenuNode menu_node;        // copy of the current node
+static uint8_t menu_selection = 0; // selected item
+static uint8_t menu_top = 0;       // first item on the screen
+
+/*
+ * copy an item of the current node from program memory
+ */
+static void menu_item(uint8_t index, MenuItem *item)
+{
+    memcpy_P(item, &menu_node.items[index], sizeof(MenuItem));
+}
+
+/*
+ * items visible at once
+ */
+static uint8_t menu_visible(void)
+{
+    return menu_node.layout == MENU_LAYOUT_FIELDS ? LCD_LINES * MENU_COLUMNS : LCD_LINES;
+}
+
+static void menu_open(const MenuNode *node)
+{
+    if (!node)
+    {
+        return;
+    }
+    memcpy_P(&menu_node, node, sizeof(MenuNode));
+    menu_selection = 0;
+    menu_top = 0;
+}
+
+/*
+ * move the selection and scroll it into view
+ */
+static void menu_move(int8_t delta)
+{
+    uint8_t step = menu_node.layout == MENU_LAYOUT_FIELDS ? MENU_COLUMNS : 1;
+
+    if (delta < 0 && menu_selection == 0)
+        return;
+    if (delta > 0 && menu_selection + 1 >= menu_node.count)
+        return;
+    menu_selection += delta;
+
+    if (menu_selection < menu_top)
+        menu_top = menu_selection - menu_selection % step;
+    else if (menu_selection >= menu_top + menu_visible())
+        menu_top = menu_selection - menu_selection % step - menu_visible() + step;
+}
+
+static uint8_t menu_activate(MenuItem *item)
+{
+    switch (item->kind)
+    {
+    case MENU_ITEM_SUBMENU:
+        menu_open(item->target.node);
+        break;
+    case MENU_ITEM_ACTION:
+        return item->target.action();
+    case MENU_ITEM_BACK:
+        menu_open(menu_node.parent);
+        break;
+    }
+    return MENU_REDRAW;
+}
+
+static void menu_edit(MenuItem *item, int8_t delta)
+{
+    if (item->kind == MENU_ITEM_NUMBER)
+    {
+        *item->target.value += delta;
+    }
+    else if (item->kind == MENU_ITEM_LETTER)
+    {
+        uint8_t value = *item->target.value + MENU_LETTERS + delta;
+        *item->target.value = value % MENU_LETTERS;
+    }
+    else if (item->kind == MENU_ITEM_LENGTH)
+    {
+        int16_t length = *item->target.length + delta;
+        if (length >= 0 && length <= MENU_LENGTH_MAX)
+            *item->target.length = length;
+    }
+}
+
+/*
+ * start at the root node
+ */
+void menu_init(const MenuNode *root)
+{
+    menu_open(root);
+}
+
+/*
+ * handle one input event
+ * returns MENU_REDRAW when the node has to be drawn again
+ */
+uint8_t menu_input(uint8_t event)
+{
+    MenuItem item;
+    menu_item(menu_selection, &item);
+
+    switch (menu_node.layout)
+    {
+    case MENU_LAYOUT_LIST:
+        if (event == MENU_EVENT_NEXT)
+            menu_move(1);
+        else if (event == MENU_EVENT_PREVIOUS)
+            menu_move(-1);
+        else if (event == MENU_EVENT_SELECT)
+            return menu_activate(&item);
+        break;
+
+    case MENU_LAYOUT_FIELDS:
+        if (event == MENU_EVENT_SELECT)
+        {
+            if (item.kind == MENU_ITEM_BACK)
+            {
+                // start over with the first field
+                menu_selection = 0;
+                menu_top = 0;
+            }
+            else if (item.kind == MENU_ITEM_ACTION)
+            {
+                return item.target.action();
+            }
+            else
+            {
+                menu_move(1);
+            }
+        }
+        else if (event == MENU_EVENT_NEXT || event == MENU_EVENT_PREVIOUS)
+        {
+            if (item.kind == MENU_ITEM_BACK)
+                menu_open(menu_node.parent);
+            else
+                menu_edit(&item, event == MENU_EVENT_NEXT ? 1 : -1);
+        }
+        break;
+
+    case MENU_LAYOUT_TEXT:
+        if (event == MENU_EVENT_NEXT && menu_top + LCD_LINES < menu_node.count)
+            menu_top++;
+        else if (event == MENU_EVENT_PREVIOUS && menu_top)
+            menu_top--;
+        else if (event == MENU_EVENT_SELECT)
+            menu_open(menu_node.parent);
+        break;
+    }
+    return MENU_REDRAW;
+}
+
+/*
+ * draw the visible items of the current node into the lcd framebuffer
+ */
+void menu_render(void)
+{
+    MenuItem item;
+
+    lcd_clrscr();
+    for (uint8_t i = 0; i < menu_visible() && menu_top + i < menu_node.count; i++)
+    {
+        uint8_t index = menu_top + i;
+        menu_item(index, &item);
+
+        if (menu_node.layout == MENU_LAYOUT_FIELDS)
+            lcd_gotoxy((i % MENU_COLUMNS) * MENU_FIELD_WIDTH, i / MENU_COLUMNS);
+        else
+            lcd_gotoxy(0, i);
+
+        if (menu_node.layout != MENU_LAYOUT_TEXT)
+            lcd_putc(index == menu_selection ? '>' : '-');
+        lcd_puts_p(item.label);
+
+        if (item.kind == MENU_ITEM_NUMBER)
+            lcd_puti(*item.target.value);
+        else if (item.kind == MENU_ITEM_LETTER)
+            lcd_putc('A' + *item.target.value);
+        else if (item.kind == MENU_ITEM_LENGTH)
+            lcd_puti(*item.target.length);
+    }
+}
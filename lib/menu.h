@@ -0,0 +1,75 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+// item kinds
+#define MENU_ITEM_SUBMENU 0 // button opens target.node
+#define MENU_ITEM_ACTION 1  // button calls target.action
+#define MENU_ITEM_BACK 2    // returns to the parent node
+#define MENU_ITEM_NUMBER 3  // editable uint8_t, shown as number
+#define MENU_ITEM_LETTER 4  // editable uint8_t, shown as 'A' + value
+#define MENU_ITEM_TEXT 5    // label only
+#define MENU_ITEM_LENGTH 6  // editable int16_t in millimetres
+
+// node layouts
+#define MENU_LAYOUT_LIST 0   // one item per line, '>' marks the selection, the button activates it
+#define MENU_LAYOUT_FIELDS 1 // two items per line, the button moves to the next item, turning edits it
+#define MENU_LAYOUT_TEXT 2   // plain lines, turning scrolls, the button returns to the parent
+
+// input events
+#define MENU_EVENT_NONE 0
+#define MENU_EVENT_NEXT 1
+#define MENU_EVENT_PREVIOUS 2
+#define MENU_EVENT_SELECT 3
+
+// result of menu_input() and of actions
+#define MENU_KEEP 0   // screen stays as it is
+#define MENU_REDRAW 1 // menu_render() has to draw the node
+
+#define MENU_FIELD_WIDTH 8 // columns per item in MENU_LAYOUT_FIELDS
+#define MENU_LETTERS 26    // range of MENU_ITEM_LETTER values
+#define MENU_LENGTH_MAX 9999 // range of MENU_ITEM_LENGTH values, 0..max fits a field
+
+typedef struct MenuNode MenuNode;
+
+typedef union
+{
+    const MenuNode *node;
+    uint8_t (*action)(void); // returns MENU_KEEP when it drew its own screen
+    uint8_t *value;
+    int16_t *length;
+} MenuTarget;
+
+typedef struct
+{
+    const char *label; // in program memory
+    uint8_t kind;
+    MenuTarget target;
+} MenuItem;
+
+// nodes and items live in program memory
+struct MenuNode
+{
+    const MenuItem *items;
+    uint8_t count;
+    uint8_t layout;
+    const MenuNode *parent;
+};
+
+#define MENU_SUBMENU(label, child) {label, MENU_ITEM_SUBMENU, {.node = child}}
+#define MENU_ACTION(label, function) {label, MENU_ITEM_ACTION, {.action = function}}
+#define MENU_BACK(label) {label, MENU_ITEM_BACK, {0}}
+#define MENU_NUMBER(label, variable) {label, MENU_ITEM_NUMBER, {.value = variable}}
+#define MENU_LETTER(label, variable) {label, MENU_ITEM_LETTER, {.value = variable}}
+#define MENU_LENGTH(label, variable) {label, MENU_ITEM_LENGTH, {.length = variable}}
+#define MENU_TEXT(label) {label, MENU_ITEM_TEXT, {0}}
+
+#define MENU_NODE(items, layout, parent) {items, sizeof(items) / sizeof(MenuItem), layout, parent}
+
+extern void menu_init(const MenuNode *root);
+extern uint8_t menu_input(uint8_t event);
+extern void menu_render(void);
+
+#endif
@@ -11,6 +11,44 @@ Please refer to LICENSE file for licensing information.
 #include "pcf8574.h"
 #include "i2cmaster.h"
 
+#if PCF8574_TXSLOTS >= I2C_QUEUE_SIZE
+#error "PCF8574_TXSLOTS must leave a free i2c queue entry for pcf8574_getinput"
+#endif
+
+// transactions handed to the i2c engine, reused round robin once finished
+typedef struct
+{
+    I2cTransaction transaction;
+    uint8_t data[PCF8574_SEQUENCE_MAX];
+} Pcf8574Slot;
+
+static Pcf8574Slot pcf8574_slots[PCF8574_TXSLOTS];
+static uint8_t pcf8574_nextslot = 0;
+
+/*
+ * queue port writes, returns as soon as the bytes are queued
+ */
+static void pcf8574_send(uint8_t deviceid, const uint8_t *data, uint8_t length)
+{
+    Pcf8574Slot *slot = &pcf8574_slots[pcf8574_nextslot];
+    if (++pcf8574_nextslot == PCF8574_TXSLOTS)
+    {
+        pcf8574_nextslot = 0;
+    }
+
+    // the slot is still queued when the bus is PCF8574_TXSLOTS writes behind
+    i2c_wait(&slot->transaction);
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        slot->data[i] = data[i];
+    }
+    slot->transaction.address = ((PCF8574_ADDRBASE + deviceid) << 1) | I2C_WRITE;
+    slot->transaction.buffer = slot->data;
+    slot->transaction.length = length;
+    i2c_submit(&slot->transaction);
+}
+
 /*
  * initialize
  */
@@ -25,6 +63,27 @@ void pcf8574_init(void)
     for (i = 0; i < PCF8574_MAXDEVICES; i++) {
         pcf8574_pinstatus[i] = 0;
     }
+
+    // mark all slots free
+    for (i = 0; i < PCF8574_TXSLOTS; i++) {
+        pcf8574_slots[i].transaction.status = I2C_DONE;
+    }
+}
+
+/*
+ * wait until all queued writes are on the bus
+ */
+void pcf8574_flush(void)
+{
+    i2c_flush();
+}
+
+/*
+ * check if queued writes are still waiting for the bus
+ */
+uint8_t pcf8574_busy(void)
+{
+    return i2c_busy();
 }
 
 /*
@@ -63,9 +122,22 @@ int8_t pcf8574_setoutput(uint8_t deviceid, uint8_t data)
     if ((deviceid >= 0 && deviceid < PCF8574_MAXDEVICES))
     {
         pcf8574_pinstatus[deviceid] = data;
-        i2c_start(((PCF8574_ADDRBASE + deviceid) << 1) | I2C_WRITE);
-        i2c_write(data);
-        i2c_stop();
+        pcf8574_send(deviceid, &data, 1);
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * set a series of output states in one transaction, the device latches every byte
+ */
+int8_t pcf8574_write_sequence(uint8_t deviceid, const uint8_t *states, uint8_t len)
+{
+    if ((deviceid >= 0 && deviceid < PCF8574_MAXDEVICES) && (len > 0 && len <= PCF8574_SEQUENCE_MAX))
+    {
+        pcf8574_pinstatus[deviceid] = states[len - 1];
+        pcf8574_send(deviceid, states, len);
         return 0;
     }
 
@@ -94,9 +166,7 @@ int8_t pcf8574_setoutputpins(uint8_t deviceid, uint8_t pinstart, uint8_t pinleng
         b |= data;
         pcf8574_pinstatus[deviceid] = b;
         // update device
-        i2c_start(((PCF8574_ADDRBASE + deviceid) << 1) | I2C_WRITE);
-        i2c_write(b);
-        i2c_stop();
+        pcf8574_send(deviceid, &b, 1);
         return 0;
     }
     return -1;
@@ -114,9 +184,7 @@ int8_t pcf8574_setoutputpin(uint8_t deviceid, uint8_t pin, uint8_t data)
         b = (data != 0) ? (b | (1 << pin)) : (b & ~(1 << pin));
         pcf8574_pinstatus[deviceid] = b;
         // update device
-        i2c_start(((PCF8574_ADDRBASE + deviceid) << 1) | I2C_WRITE);
-        i2c_write(b);
-        i2c_stop();
+        pcf8574_send(deviceid, &b, 1);
         return 0;
     }
     return -1;
@@ -146,9 +214,19 @@ int8_t pcf8574_getinput(uint8_t deviceid)
     int8_t data = -1;
     if ((deviceid >= 0 && deviceid < PCF8574_MAXDEVICES))
     {
-        i2c_start(((PCF8574_ADDRBASE + deviceid) << 1) | I2C_READ);
-        data = ~i2c_readNak();
-        i2c_stop();
+        // queued behind the pending writes, so the port is read after they are latched
+        uint8_t b = 0;
+        I2cTransaction transaction;
+        transaction.address = ((PCF8574_ADDRBASE + deviceid) << 1) | I2C_READ;
+        transaction.buffer = &b;
+        transaction.length = 1;
+        while (i2c_submit(&transaction))
+        {
+        }
+        if (i2c_wait(&transaction) == I2C_DONE)
+        {
+            data = ~b;
+        }
     }
     return data;
 }
@@ -15,14 +15,20 @@ Please refer to LICENSE file for licensing information.
 #define PCF8574_MAXDEVICES 8 // max devices, depends on address (3 bit)
 #define PCF8574_MAXPINS 8    // max pin per device
 
+#define PCF8574_TXSLOTS 6 // writes that can be queued before a write has to wait for the bus
+#define PCF8574_SEQUENCE_MAX 8 // max port states sent in one transaction
+
 // pin status
 volatile uint8_t pcf8574_pinstatus[PCF8574_MAXDEVICES];
 
 // functions
 void pcf8574_init(void);
+extern void pcf8574_flush(void);
+extern uint8_t pcf8574_busy(void);
 extern int8_t pcf8574_getoutput(uint8_t deviceid);
 extern int8_t pcf8574_getoutputpin(uint8_t deviceid, uint8_t pin);
 extern int8_t pcf8574_setoutput(uint8_t deviceid, uint8_t data);
+extern int8_t pcf8574_write_sequence(uint8_t deviceid, const uint8_t *states, uint8_t len);
 extern int8_t pcf8574_setoutputpins(uint8_t deviceid, uint8_t pinstart, uint8_t pinlength, int8_t data);
 extern int8_t pcf8574_setoutputpin(uint8_t deviceid, uint8_t pin, uint8_t data);
 extern int8_t pcf8574_setoutputpinhigh(uint8_t deviceid, uint8_t pin);
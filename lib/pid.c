@@ -0,0 +1,78 @@
+/*
+pid lib 0x01
+
+Fixed point PID position controller with anti-windup and an
+in-position window.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "pid.h"
+
+static int32_t pid_clamp(int32_t value, int32_t limit)
+{
+    if (value > limit)
+        return limit;
+    if (value < -limit)
+        return -limit;
+    return value;
+}
+
+void pid_init(Pid *pid, int16_t kp, int16_t ki, int16_t kd, int16_t outputMax, int16_t outputMin, uint16_t window)
+{
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->outputMax = outputMax;
+    pid->outputMin = outputMin;
+    pid->window = window;
+    pid_reset(pid, 0);
+}
+
+/*
+ * clear the integral and start the derivative from measurement,
+ * use it when the loop was not running
+ */
+void pid_reset(Pid *pid, int32_t measurement)
+{
+    pid->integral = 0;
+    pid->previous = measurement;
+    pid->inPosition = 0;
+}
+
+/*
+ * one controller step, returns the output -outputMax..outputMax
+ */
+int16_t pid_update(Pid *pid, int32_t setpoint, int32_t measurement)
+{
+    int32_t error = pid_clamp(setpoint - measurement, PID_ERROR_MAX);
+    int32_t change = pid_clamp(measurement - pid->previous, PID_ERROR_MAX);
+    int32_t limit = (int32_t)pid->outputMax << 8;
+
+    pid->previous = measurement;
+
+    // stop inside the window instead of hunting around the setpoint
+    if ((error < 0 ? -error : error) <= pid->window)
+    {
+        pid->integral = 0;
+        pid->inPosition = 1;
+        return 0;
+    }
+    pid->inPosition = 0;
+
+    int32_t output = pid_clamp((int32_t)pid->kp * error - (int32_t)pid->kd * change, limit);
+
+    // integrate only while the output is not saturated in the same direction
+    if (!((output >= limit && error > 0) || (output <= -limit && error < 0)))
+    {
+        pid->integral = pid_clamp(pid->integral + (int32_t)pid->ki * error, limit);
+    }
+    output = pid_clamp(output + pid->integral, limit) / 256;
+
+    if (output > 0 && output < pid->outputMin)
+        output = pid->outputMin;
+    else if (output < 0 && output > -pid->outputMin)
+        output = -pid->outputMin;
+    return output;
+}
@@ -0,0 +1,31 @@
+#ifndef PID_H
+#define PID_H
+
+#include <inttypes.h>
+
+/*
+ * Fixed point PID position controller, gains are Q8.8 (256 = 1.0)
+ * and act on the error in counts, the output is a motor speed.
+ * Call pid_update() at a fixed rate, the gains include the period.
+ */
+#define PID_GAIN(gain) ((int16_t)((gain) * 256 + 0.5))
+#define PID_ERROR_MAX 32767 // errors are clamped so the products fit in 32 bit
+
+typedef struct
+{
+    int16_t kp;
+    int16_t ki;
+    int16_t kd;
+    int16_t outputMax; // output limit, -max..max
+    int16_t outputMin; // smallest output outside the window, overcomes friction
+    uint16_t window;   // in-position window in counts, the output is 0 inside it
+    int32_t integral;  // Q8.8, clamped to the output limit (anti-windup)
+    int32_t previous;  // last measurement, the derivative acts on the measurement
+    uint8_t inPosition;
+} Pid;
+
+extern void pid_init(Pid *pid, int16_t kp, int16_t ki, int16_t kd, int16_t outputMax, int16_t outputMin, uint16_t window);
+extern void pid_reset(Pid *pid, int32_t measurement);
+extern int16_t pid_update(Pid *pid, int32_t setpoint, int32_t measurement);
+
+#endif
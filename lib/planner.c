@@ -0,0 +1,470 @@
+/*
+planner lib 0x01
+
+Motion queue with look-ahead junction speeds, runs the queued moves
+through one path profile and the line interpolator.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include <util/atomic.h>
+#include "planner.h"
+
+#if PLANNER_QUEUE_SIZE & (PLANNER_QUEUE_SIZE - 1)
+#error PLANNER_QUEUE_SIZE must be a power of two
+#endif
+
+#define PLANNER_MASK (PLANNER_QUEUE_SIZE - 1)
+#define PLANNER_UNIT 16384L // Q14
+
+// moves that start and end at rest
+#define PLANNER_STOPS(move) ((move)->z || (move)->dwell)
+
+// ticks from asking for a lower to its first step, the main loop polls every tick
+#define PLANNER_Z_LATENCY 8
+
+// counts/s to profile units, Q16 counts per tick
+static int32_t planner_velocity(Planner *planner, uint32_t countsPerSecond)
+{
+    return (int32_t)((countsPerSecond << 16) / planner->rate);
+}
+
+// counts/s^2 to profile units, Q16 counts per tick^2
+static int32_t planner_acceleration(Planner *planner, uint32_t countsPerSecond2)
+{
+    uint32_t rate2 = (uint32_t)planner->rate * planner->rate;
+
+    return (int32_t)(((countsPerSecond2 << 16) + rate2 / 2) / rate2);
+}
+
+// speed in the form of the profile braking test, (velocity >> 8)^2
+static uint32_t planner_square(int32_t velocity)
+{
+    uint32_t speed8 = (uint32_t)velocity >> 8;
+
+    return speed8 * speed8;
+}
+
+// squared speed after accelerating over distance, saturates
+static uint32_t planner_reach(uint32_t speedSquared, int32_t accelerationMax, int32_t distance)
+{
+    uint32_t gain = 2 * (uint32_t)accelerationMax;
+
+    if ((uint32_t)distance > (0xFFFFFFFFUL - speedSquared) / gain)
+        return 0xFFFFFFFFUL;
+    return speedSquared + gain * (uint32_t)distance;
+}
+
+// ticks a Z ramp takes from rest over distance steps, saturates
+static uint16_t planner_z_ticks(Planner *planner, uint32_t distance)
+{
+    uint32_t velocity = planner->zVelocity;
+    uint32_t acceleration = planner->zAcceleration;
+    uint32_t ticks;
+
+    if (2 * acceleration * distance <= velocity * velocity)
+    {
+        // still accelerating, t = sqrt(2 d / a)
+        uint32_t square = 2 * distance * planner->rate / acceleration;
+        if (square > 0xFFFFFFFFUL / planner->rate)
+            return 0xFFFF;
+        ticks = profile_sqrt(square * planner->rate);
+    }
+    else
+    {
+        // at full speed after v / 2a, t = d / v + v / 2a
+        ticks = distance * planner->rate / velocity + velocity * planner->rate / (2 * acceleration);
+    }
+    return ticks > 0xFFFF ? 0xFFFF : ticks;
+}
+
+void planner_init(Planner *planner, uint16_t rate, uint16_t velocity, uint16_t acceleration,
+                  uint16_t zVelocity, uint16_t zAcceleration, uint16_t junctionJump, uint8_t smoothing)
+{
+    int32_t origin[PLANNER_AXES] = {0, 0, 0};
+
+    planner->rate = rate;
+    planner->velocity = velocity;
+    planner->acceleration = acceleration;
+    planner->zVelocity = zVelocity;
+    planner->zAcceleration = zAcceleration;
+    planner->junctionJump = planner_velocity(planner, junctionJump);
+    planner->head = 0;
+    profile_init(&planner->path, planner_velocity(planner, velocity), planner_acceleration(planner, acceleration), smoothing);
+    interpolate_init(&planner->line, 2, origin);
+    planner_reset(planner, origin);
+}
+
+/*
+ * drop the queue and stand still at position,
+ * call with interrupts off or from the control interrupt
+ */
+void planner_reset(Planner *planner, const int32_t *position)
+{
+    planner->cursor = planner->head;
+    planner->tail = planner->head;
+    planner->epoch++;
+    planner->zState = PLANNER_Z_IDLE;
+    planner->zMove = planner->head;
+    planner->entered = 0;
+    planner->lineEntered = 0;
+    planner->dwell = 0;
+    for (uint8_t i = 0; i < PLANNER_AXES; i++)
+    {
+        planner->target[i] = position[i];
+    }
+    planner->end = 0;
+    planner->pathTarget = 0;
+    profile_reset(&planner->path, 0);
+    interpolate_reset(&planner->line, position);
+}
+
+/*
+ * fastest exit from previous into move without a jump above junctionJump
+ * on any axis, both moves are X/Y only
+ */
+static uint32_t planner_junction(Planner *planner, PlannerMove *previous, PlannerMove *move)
+{
+    int32_t velocity = previous->velocityMax < move->velocityMax ? previous->velocityMax : move->velocityMax;
+    int32_t change = 0;
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        int32_t difference = (int32_t)previous->unit[i] - move->unit[i];
+        if (difference < 0)
+            difference = -difference;
+        if (difference > change)
+            change = difference;
+    }
+    // the axis speed changes by v * change / PLANNER_UNIT at the corner
+    if (change && planner->junctionJump * PLANNER_UNIT / change < velocity)
+        velocity = planner->junctionJump * PLANNER_UNIT / change;
+    return planner_square(velocity);
+}
+
+/*
+ * queue a move to target, or a dwell at the end of the queue
+ */
+static uint8_t planner_queue(Planner *planner, const int32_t *target, uint16_t dwell, uint16_t clearance)
+{
+    int32_t from[PLANNER_AXES];
+    int32_t end;
+    uint8_t epoch;
+    uint8_t same = !dwell;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for (uint8_t i = 0; i < PLANNER_AXES; i++)
+        {
+            from[i] = planner->target[i];
+        }
+        end = planner->end;
+        epoch = planner->epoch;
+    }
+    if (dwell)
+        target = from; // wait where the queue ends
+    for (uint8_t i = 0; i < PLANNER_AXES; i++)
+    {
+        if (from[i] != target[i])
+            same = 0;
+    }
+    if (same)
+        return 1;
+
+    uint8_t index = planner->head;
+    uint8_t next = (index + 1) & PLANNER_MASK;
+    if (next == planner->tail)
+        return 0;
+
+    // the entry is not visible to the interrupt until head moves
+    PlannerMove *move = &planner->queue[index];
+    int32_t delta[2];
+    uint32_t length = 0;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        delta[i] = target[i] - from[i];
+        uint32_t distance = delta[i] < 0 ? -delta[i] : delta[i];
+        if (distance > length)
+            length = distance;
+    }
+    uint32_t zDistance = target[2] > from[2] ? target[2] - from[2] : from[2] - target[2];
+
+    // the faster motion gets lower limits so X/Y and Z take as long,
+    // compare the time per unit of distance, v / d, without dividing
+    uint32_t velocity = planner->velocity;
+    uint32_t acceleration = planner->acceleration;
+    uint32_t zVelocity = planner->zVelocity;
+    uint32_t zAcceleration = planner->zAcceleration;
+    if (length && zDistance)
+    {
+        if (zVelocity * length < velocity * zDistance)
+            velocity = zVelocity * length / zDistance;
+        else
+            zVelocity = velocity * zDistance / length;
+        if (zAcceleration * length < acceleration * zDistance)
+            acceleration = zAcceleration * length / zDistance;
+        else
+            zAcceleration = acceleration * zDistance / length;
+    }
+
+    for (uint8_t i = 0; i < PLANNER_AXES; i++)
+    {
+        move->target[i] = target[i];
+    }
+    move->length = length;
+    move->end = end + length;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        move->unit[i] = length ? delta[i] * PLANNER_UNIT / (int32_t)length : 0;
+    }
+    move->velocityMax = planner_velocity(planner, velocity);
+    if (!move->velocityMax)
+        move->velocityMax = 1;
+    move->accelerationMax = planner_acceleration(planner, acceleration);
+    move->zVelocity = zVelocity ? zVelocity : 1;
+    move->zAcceleration = zAcceleration ? zAcceleration : 1;
+    move->z = zDistance != 0;
+    move->zClearance = 0;
+    move->zLead = 0;
+    if (!length && zDistance && clearance)
+    {
+        if (target[2] < from[2])
+        {
+            move->zClearance = clearance;
+        }
+        else
+        {
+            // the ramp crosses the band from rest, the X/Y move before has to settle in that time
+            uint16_t ticks = planner_z_ticks(planner, clearance < zDistance ? clearance : zDistance);
+            move->zLead = ticks > PLANNER_Z_LATENCY ? ticks - PLANNER_Z_LATENCY : 0;
+        }
+    }
+    move->dwell = dwell;
+    move->junctionMax = 0;
+    move->exitSquared = 0;
+
+    uint8_t cursor;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (planner->epoch != epoch)
+            return 0; // reset since from was read
+        planner->head = next;
+        for (uint8_t i = 0; i < PLANNER_AXES; i++)
+        {
+            planner->target[i] = target[i];
+        }
+        planner->end = move->end;
+        cursor = planner->cursor;
+    }
+
+    if (index != cursor)
+    {
+        // the corner to the new move, moves with Z travel and dwells stop at both ends
+        PlannerMove *previous = &planner->queue[(index - 1) & PLANNER_MASK];
+        previous->junctionMax = PLANNER_STOPS(previous) || PLANNER_STOPS(move) ? 0 : planner_junction(planner, previous, move);
+    }
+
+    // look back from the new move while the profile has not passed the junctions
+    uint32_t entrySquared = planner_reach(0, move->accelerationMax, move->length);
+    while (index != cursor)
+    {
+        index = (index - 1) & PLANNER_MASK;
+        move = &planner->queue[index];
+
+        uint32_t exitSquared = move->junctionMax < entrySquared ? move->junctionMax : entrySquared;
+        if (exitSquared <= move->exitSquared)
+            break; // the moves before already allow it
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            move->exitSquared = exitSquared;
+        }
+        entrySquared = planner_reach(exitSquared, move->accelerationMax, move->length);
+    }
+    return 1;
+}
+
+/*
+ * queue a move to target, call from the main loop
+ * returns 1 when target is queued or already the end of the queue,
+ * 0 when the queue is full
+ */
+uint8_t planner_push(Planner *planner, const int32_t *target)
+{
+    return planner_queue(planner, target, 0, 0);
+}
+
+/*
+ * queue a Z only move to target that overlaps with the X/Y moves next to
+ * it while Z is within clearance counts of its upper end, call from the
+ * main loop, returns like planner_push()
+ */
+uint8_t planner_push_clear(Planner *planner, const int32_t *target, uint16_t clearance)
+{
+    return planner_queue(planner, target, 0, clearance);
+}
+
+/*
+ * queue a wait of ticks at the end of the queue, call from the main loop
+ * returns 0 when the queue is full
+ */
+uint8_t planner_dwell(Planner *planner, uint16_t ticks)
+{
+    return ticks ? planner_queue(planner, 0, ticks, 0) : 1;
+}
+
+/*
+ * moves that can still be queued, call from the main loop
+ */
+uint8_t planner_free(Planner *planner)
+{
+    return (planner->tail - planner->head - 1) & PLANNER_MASK;
+}
+
+/*
+ * advance the profile and the interpolator one tick,
+ * call from the control interrupt
+ */
+void planner_update(Planner *planner)
+{
+    uint8_t head = planner->head;
+    uint8_t cursor = planner->cursor;
+    PlannerMove *move = &planner->queue[cursor];
+
+    if (planner->entered && planner->dwell)
+        planner->dwell--;
+
+    // leave the move the profile has passed, a move that stops only once it stands still,
+    // a lift in its clearance already when an X/Y move follows
+    uint8_t next = (cursor + 1) & PLANNER_MASK;
+    uint8_t zDone = planner->zState == PLANNER_Z_FINISHED ||
+                    (planner->zState == PLANNER_Z_CLEAR && next != head &&
+                     !planner->queue[next].z && !planner->queue[next].dwell);
+    if (planner->entered && planner->path.position >= move->end && !planner->dwell &&
+        (move->exitSquared || !planner->path.velocity) && (!move->z || zDone))
+    {
+        if (move->z)
+            planner->zState = PLANNER_Z_IDLE;
+        cursor = next;
+        planner->cursor = cursor;
+        planner->entered = 0;
+        move = &planner->queue[cursor];
+    }
+
+    // enter the next one, moves that stop only from rest,
+    // with Z travel after the main loop started the ramp
+    if (!planner->entered && cursor != head)
+    {
+        uint8_t rest = planner->tail == cursor && profile_done(&planner->path, planner->pathTarget);
+
+        if (move->z && planner->zState == PLANNER_Z_IDLE && rest)
+        {
+            planner->zState = PLANNER_Z_READY;
+            planner->zMove = cursor;
+        }
+        if (move->z ? planner->zMove == cursor && planner->zState >= PLANNER_Z_STARTED : !move->dwell || rest)
+        {
+            planner->entered = 1;
+            planner->dwell = move->dwell;
+            planner->pathTarget = move->end;
+            profile_limit(&planner->path, move->velocityMax, move->accelerationMax);
+        }
+    }
+
+    planner->path.exitSquared = planner->entered ? move->exitSquared : 0;
+    int32_t path = profile_update(&planner->path, planner->pathTarget);
+
+    // ask for a lower early once the X/Y move in front of it settles within its lead
+    next = (cursor + 1) & PLANNER_MASK;
+    if (planner->entered && planner->zState == PLANNER_Z_IDLE && !move->z && !move->dwell &&
+        next != head && planner->queue[next].zLead &&
+        profile_settles(&planner->path, planner->pathTarget, planner->queue[next].zLead))
+    {
+        planner->zState = PLANNER_Z_READY;
+        planner->zMove = next;
+    }
+
+    // the interpolator follows the smoothed path, which lags behind the profile
+    uint8_t tail = planner->tail;
+    while (tail != head)
+    {
+        move = &planner->queue[tail];
+        if (!planner->lineEntered)
+        {
+            if (tail == cursor && !planner->entered)
+                break;
+            interpolate_start(&planner->line, move->target);
+            planner->lineStart = move->end - move->length;
+            planner->lineEntered = 1;
+        }
+        interpolate_update(&planner->line, path - planner->lineStart);
+        if (path < move->end || tail == cursor)
+            break;
+        tail = (tail + 1) & PLANNER_MASK;
+        planner->tail = tail; // release the move
+        planner->lineEntered = 0;
+    }
+}
+
+/*
+ * true when the queue is empty and the setpoints have settled,
+ * call with interrupts off
+ */
+uint8_t planner_idle(Planner *planner)
+{
+    return planner->tail == planner->head && profile_done(&planner->path, planner->pathTarget);
+}
+
+/*
+ * move that waits for its Z ramp, 0 when there is none
+ */
+PlannerMove *planner_z_ready(Planner *planner)
+{
+    return planner->zState == PLANNER_Z_READY ? &planner->queue[planner->zMove] : 0;
+}
+
+/*
+ * the Z ramp of the waiting move runs, call after starting it
+ * returns 0 when the queue was reset meanwhile and the ramp has to be stopped
+ */
+uint8_t planner_z_start(Planner *planner)
+{
+    uint8_t started = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (planner->zState == PLANNER_Z_READY)
+        {
+            planner->zState = PLANNER_Z_STARTED;
+            started = 1;
+        }
+    }
+    return started;
+}
+
+/*
+ * the Z ramp is complete, call while the stepper is idle
+ */
+void planner_z_done(Planner *planner)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (planner->zState == PLANNER_Z_STARTED || planner->zState == PLANNER_Z_CLEAR)
+            planner->zState = PLANNER_Z_FINISHED;
+    }
+}
+
+/*
+ * Z of the running ramp, call from the main loop while the stepper moves,
+ * a lift in its clearance lets the X/Y move after it start
+ */
+void planner_z_clear(Planner *planner, int32_t position)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        PlannerMove *move = &planner->queue[planner->zMove];
+        if (planner->zState == PLANNER_Z_STARTED && move->zClearance &&
+            position - move->target[2] <= move->zClearance)
+            planner->zState = PLANNER_Z_CLEAR;
+    }
+}
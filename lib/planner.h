@@ -0,0 +1,101 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <inttypes.h>
+#include "profile.h"
+#include "interpolate.h"
+
+/*
+ * Queue of straight X/Y/Z moves with look-ahead. The main loop pushes
+ * targets, the control interrupt runs them with one path profile along
+ * all moves and the interpolator for the X/Y setpoints.
+ *
+ * The corner between two X/Y moves limits the speed at the junction so
+ * no axis changes speed by more than junctionJump at once. Every push
+ * walks back over the queue so each junction can still brake to the
+ * moves behind it. The limits only ever grow, so the running move is
+ * never asked to brake harder than it already planned.
+ *
+ * Z is timed by the stepper ramp in the main loop: moves with Z travel
+ * start and end at rest. The interrupt stops in front of them and asks
+ * for the Z ramp with planner_z_ready(), the X/Y part runs once the main
+ * loop started it and the move ends when both are done. A dwell waits
+ * at rest for a number of control ticks, for example for the gripper.
+ *
+ * Z only moves pushed with planner_push_clear() overlap with the X/Y
+ * moves next to them while Z is within clearance of their upper end, the
+ * smaller Z count. A lift hands over to the X/Y move after it once the
+ * main loop reports Z in that band with planner_z_clear(), its ramp
+ * finishes during the X/Y move. A lower is asked for while the X/Y move
+ * before it brakes, so early that Z only leaves the band after the X/Y
+ * setpoints have settled. X/Y never move with Z below the band.
+ */
+#define PLANNER_QUEUE_SIZE 8 // moves, power of two
+#define PLANNER_AXES 3       // X and Y are interpolated, Z is stepped
+
+// Z state of the move the profile is in
+#define PLANNER_Z_IDLE 0
+#define PLANNER_Z_READY 1    // waiting for the main loop to start the ramp
+#define PLANNER_Z_STARTED 2
+#define PLANNER_Z_FINISHED 3
+#define PLANNER_Z_CLEAR 4    // a lift is within its clearance, X/Y may run on
+
+typedef struct
+{
+    int32_t target[PLANNER_AXES];     // counts
+    int32_t length;                   // path counts, the longest X/Y axis
+    int32_t end;                      // path position at the end of the move
+    int16_t unit[2];                  // X/Y counts per path count, Q14
+    int32_t velocityMax;              // path, profile units (Q16 per tick)
+    int32_t accelerationMax;
+    uint16_t zVelocity;               // steps/s, scaled to the X/Y duration
+    uint16_t zAcceleration;           // steps/s^2
+    uint8_t z;                        // the move has Z travel
+    uint16_t zClearance;              // lift: Z counts from the target where X/Y run on, 0 = none
+    uint16_t zLead;                   // lower: ticks its ramp starts before X/Y settle, 0 = none
+    uint16_t dwell;                   // ticks to wait at rest, 0 for a move
+    uint32_t junctionMax;             // exit speed allowed by the corner, (velocity >> 8)^2
+    volatile uint32_t exitSquared;    // planned exit speed, (velocity >> 8)^2
+} PlannerMove;
+
+typedef struct
+{
+    PlannerMove queue[PLANNER_QUEUE_SIZE];
+    volatile uint8_t head;   // written by the main loop only
+    volatile uint8_t cursor; // move of the profile, written by the interrupt only
+    volatile uint8_t tail;   // move of the interpolator, written by the interrupt only
+    volatile uint8_t epoch;  // counts planner_reset(), a push of an older epoch is dropped
+    volatile uint8_t zState;
+    uint8_t zMove;           // move of zState, the cursor or the lower after it
+    uint8_t entered;         // the profile runs the cursor move
+    uint8_t lineEntered;     // the interpolator runs the tail move
+    uint16_t dwell;          // ticks left of the cursor dwell
+    int32_t target[PLANNER_AXES]; // end of the last queued move
+    int32_t end;             // path position at the end of the last queued move
+    int32_t pathTarget;      // end of the cursor move
+    int32_t lineStart;       // path position at the start of the tail move
+    uint16_t rate;           // control ticks/s
+    uint16_t velocity;       // X/Y counts/s
+    uint16_t acceleration;   // X/Y counts/s^2
+    uint16_t zVelocity;      // Z steps/s
+    uint16_t zAcceleration;  // Z steps/s^2
+    int32_t junctionJump;    // profile units
+    Profile path;
+    Interpolator line;       // X/Y setpoints
+} Planner;
+
+extern void planner_init(Planner *planner, uint16_t rate, uint16_t velocity, uint16_t acceleration,
+                         uint16_t zVelocity, uint16_t zAcceleration, uint16_t junctionJump, uint8_t smoothing);
+extern void planner_reset(Planner *planner, const int32_t *position);
+extern uint8_t planner_push(Planner *planner, const int32_t *target);
+extern uint8_t planner_push_clear(Planner *planner, const int32_t *target, uint16_t clearance);
+extern uint8_t planner_dwell(Planner *planner, uint16_t ticks);
+extern uint8_t planner_free(Planner *planner);
+extern void planner_update(Planner *planner);
+extern uint8_t planner_idle(Planner *planner);
+extern PlannerMove *planner_z_ready(Planner *planner);
+extern uint8_t planner_z_start(Planner *planner);
+extern void planner_z_done(Planner *planner);
+extern void planner_z_clear(Planner *planner, int32_t position);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+profile lib 0x01
+
+Online trapezoid / S-curve motion profile with integer math,
+no divisions so it is cheap enough for every control tick.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "profile.h"
+
+#define PROFILE_REACH_MAX 0x00100000L // beyond this distance the axis never has to brake
+
+void profile_init(Profile *profile, int32_t velocityMax, int32_t accelerationMax, uint8_t smoothing)
+{
+    profile_limit(profile, velocityMax, accelerationMax);
+    profile->smoothing = smoothing > PROFILE_SMOOTHING_MAX ? PROFILE_SMOOTHING_MAX : smoothing;
+    profile_reset(profile, 0);
+}
+
+/*
+ * change the limits, also while moving
+ */
+void profile_limit(Profile *profile, int32_t velocityMax, int32_t accelerationMax)
+{
+    profile->velocityMax = velocityMax;
+    profile->accelerationMax = accelerationMax > 0 ? accelerationMax : 1;
+}
+
+/*
+ * stand still at position
+ */
+void profile_reset(Profile *profile, int32_t position)
+{
+    uint8_t window = 1 << profile->smoothing;
+
+    profile->position = position;
+    profile->fraction = 0;
+    profile->velocity = 0;
+    for (uint8_t i = 0; i < window; i++)
+    {
+        profile->history[i] = position;
+    }
+    profile->sum = position * window;
+    profile->index = 0;
+    profile->output = position;
+    profile->exitSquared = 0;
+}
+
+/*
+ * integer square root, rounded down
+ */
+uint16_t profile_sqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/*
+ * true when the axis has to brake now to stop within remaining counts
+ */
+static uint8_t profile_braking(Profile *profile, int32_t remaining)
+{
+    uint32_t speed = profile->velocity < 0 ? -profile->velocity : profile->velocity;
+    uint32_t distance = remaining < 0 ? -remaining : remaining;
+
+    if (distance >= PROFILE_REACH_MAX)
+        return 0;
+
+    // towards a larger position the fraction is already part of the way
+    if (remaining > 0 && profile->fraction && distance)
+        distance--;
+
+    // brake when (v^2 - exit^2) / 2a, plus v/2 for the discrete steps, reaches the distance,
+    // the speed is rounded up so the test errs on braking early
+    uint32_t speed8 = (speed + 255) >> 8;
+    distance = (distance << 1) > (speed >> 16) ? (distance << 1) - (speed >> 16) : 0;
+    uint32_t braking = distance * (uint32_t)profile->accelerationMax;
+    return speed8 * speed8 >= braking && speed8 * speed8 - braking >= profile->exitSquared;
+}
+
+/*
+ * advance one tick towards target, returns the position setpoint
+ */
+int32_t profile_update(Profile *profile, int32_t target)
+{
+    int32_t remaining = target - profile->position;
+    int32_t velocity = profile->velocity;
+    int32_t acceleration = profile->accelerationMax;
+    int8_t direction = remaining > 0 ? 1 : -1;
+
+    if ((remaining >= -1 && remaining <= 1) && (velocity >= -acceleration && velocity <= acceleration))
+    {
+        // close enough to stop on the target
+        profile->position = target;
+        profile->fraction = 0;
+        velocity = 0;
+    }
+    else
+    {
+        if (remaining == 0 || (velocity > 0 && remaining < 0) || (velocity < 0 && remaining > 0) || profile_braking(profile, remaining))
+        {
+            // slow down without reversing in the same tick
+            if (velocity > acceleration)
+                velocity -= acceleration;
+            else if (velocity < -acceleration)
+                velocity += acceleration;
+            else
+                velocity = 0;
+        }
+        else
+        {
+            velocity += direction * acceleration;
+        }
+
+        if (velocity > profile->velocityMax)
+            velocity = profile->velocityMax;
+        else if (velocity < -profile->velocityMax)
+            velocity = -profile->velocityMax;
+
+        int32_t step = velocity + profile->fraction;
+        int32_t position = profile->position + (step >> 16);
+        if ((remaining > 0 && velocity > 0 && position >= target) || (remaining < 0 && velocity < 0 && position <= target))
+        {
+            // the target is reached this tick, never faster than the exit speed
+            int32_t exit = (int32_t)profile_sqrt(profile->exitSquared) << 8;
+            if (!exit)
+            {
+                // stop on the target instead of passing it
+                position = target;
+                step = 0;
+                velocity = 0;
+            }
+            else if (velocity > exit || velocity < -exit)
+            {
+                velocity = direction * exit;
+            }
+        }
+        profile->position = position;
+        profile->fraction = step & 0xFFFF;
+    }
+    profile->velocity = velocity;
+
+    // moving average of the trapezoid, the S-curve setpoint
+    uint8_t window = 1 << profile->smoothing;
+    profile->sum += profile->position - profile->history[profile->index];
+    profile->history[profile->index] = profile->position;
+    profile->index = (profile->index + 1) & (window - 1);
+    profile->output = (profile->sum + (window >> 1)) >> profile->smoothing;
+    return profile->output;
+}
+
+/*
+ * true when the setpoint has settled on target
+ */
+uint8_t profile_done(Profile *profile, int32_t target)
+{
+    return profile->velocity == 0 && profile->position == target && profile->output == target;
+}
+
+/*
+ * true when the setpoint settles on target within ticks: the trapezoid
+ * stands on it or already brakes to stop on it, the average follows
+ * within the window
+ */
+uint8_t profile_settles(Profile *profile, int32_t target, uint16_t ticks)
+{
+    int32_t remaining = target - profile->position;
+    int32_t velocity = profile->velocity;
+    uint16_t lag = (1 << profile->smoothing) + 2; // window, plus the last braking tick and the snap on the target
+
+    if (ticks < lag)
+        return 0;
+    if (!velocity)
+        return !remaining;
+    if (profile->exitSquared || (remaining > 0) != (velocity > 0) || !profile_braking(profile, remaining))
+        return 0;
+    // braking takes v / a ticks
+    uint32_t speed = velocity < 0 ? -velocity : velocity;
+    return speed <= (uint32_t)profile->accelerationMax * (ticks - lag);
+}
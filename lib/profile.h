@@ -0,0 +1,49 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <inttypes.h>
+
+/*
+ * Online motion profile, called once per control tick it moves a position
+ * setpoint towards the target with limited velocity and acceleration
+ * (trapezoid). The trapezoid position is averaged over 2^smoothing ticks,
+ * this limits the jerk and turns the trapezoid into an S-curve without
+ * changing where it ends. The target may change at any time.
+ * exitSquared lets the trapezoid pass the target at a speed instead of
+ * stopping on it, the caller moves the target on once it is reached.
+ *
+ * Velocity is in counts per tick and acceleration in counts per tick^2,
+ * both Q16 (65536 = 1 count). The braking test stays within 32 bit for
+ * velocities below 255 counts per tick and accelerations below 1024.
+ */
+#define PROFILE_SMOOTHING_MAX 5 // largest smoothing, 32 ticks
+#define PROFILE_WINDOW_MAX (1 << PROFILE_SMOOTHING_MAX)
+
+// convert from counts/s and counts/s^2 at a tick rate in Hz
+#define PROFILE_VELOCITY(countsPerSecond, rate) ((int32_t)((countsPerSecond) * 65536.0 / (rate)))
+#define PROFILE_ACCELERATION(countsPerSecond2, rate) ((int32_t)((countsPerSecond2) * 65536.0 / ((double)(rate) * (rate)) + 0.5))
+
+typedef struct
+{
+    int32_t velocityMax;     // Q16
+    int32_t accelerationMax; // Q16, at least 1
+    uint8_t smoothing;       // log2 of the averaging window, 0 = trapezoid
+    int32_t position;        // trapezoid position, counts
+    uint16_t fraction;       // trapezoid position, Q16 part
+    int32_t velocity;        // Q16, signed
+    int32_t history[PROFILE_WINDOW_MAX]; // last trapezoid positions
+    int32_t sum;             // sum of the history window
+    uint8_t index;
+    int32_t output;          // smoothed setpoint, counts
+    uint32_t exitSquared;    // speed at the target, (velocity >> 8)^2, 0 = stop
+} Profile;
+
+extern void profile_init(Profile *profile, int32_t velocityMax, int32_t accelerationMax, uint8_t smoothing);
+extern void profile_limit(Profile *profile, int32_t velocityMax, int32_t accelerationMax);
+extern void profile_reset(Profile *profile, int32_t position);
+extern int32_t profile_update(Profile *profile, int32_t target);
+extern uint8_t profile_done(Profile *profile, int32_t target);
+extern uint8_t profile_settles(Profile *profile, int32_t target, uint16_t ticks);
+extern uint16_t profile_sqrt(uint32_t value);
+
+#endif
@@ -0,0 +1,31 @@
+/*
+quadrature lib 0x01
+
+Table driven quadrature decoder, counts every edge of A and B
+(4 counts per cycle). B leading A counts up.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "quadrature.h"
+
+#define X QUADRATURE_ILLEGAL
+
+const int8_t quadrature_table[16] = {
+    /* new AB:  00  01  10  11 */
+    /* 00 */ 0, +1, -1, X,
+    /* 01 */ -1, 0, X, +1,
+    /* 10 */ +1, X, 0, -1,
+    /* 11 */ X, -1, +1, 0};
+
+#undef X
+
+/*
+ * start decoding from the current AB state
+ */
+void quadrature_init(Quadrature *decoder, uint8_t ab)
+{
+    decoder->state = ab & 0x03;
+    decoder->errors = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef QUADRATURE_H
+#define QUADRATURE_H
+
+#include <inttypes.h>
+
+#define QUADRATURE_EDGES_PER_CYCLE 4
+#define QUADRATURE_ILLEGAL 2 // table entry for a transition where A and B changed at once
+
+// build the 2 bit AB state from a port value
+#define QUADRATURE_AB(port, pinA, pinB) (((((port) >> (pinA)) & 1) << 1) | (((port) >> (pinB)) & 1))
+
+typedef struct
+{
+    uint8_t state;   // last AB state
+    uint16_t errors; // illegal transitions, edges were missed
+} Quadrature;
+
+// (previous AB << 2 | new AB) -> -1, 0, +1 or QUADRATURE_ILLEGAL
+extern const int8_t quadrature_table[16];
+
+extern void quadrature_init(Quadrature *decoder, uint8_t ab);
+
+/*
+ * decode one sample, returns the count change (-1, 0, +1)
+ * inline so a sample costs a table lookup inside the sampling interrupt
+ */
+static inline int8_t quadrature_update(Quadrature *decoder, uint8_t ab)
+{
+    int8_t delta = quadrature_table[(decoder->state << 2) | ab];
+    decoder->state = ab;
+    if (delta == QUADRATURE_ILLEGAL)
+    {
+        decoder->errors++;
+        return 0;
+    }
+    return delta;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+scheduler lib 0x01
+
+Cooperative fixed rate task scheduler on the systick time base.
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include "systick.h"
+#include "scheduler.h"
+
+/*
+ * start the systick and make every task due now
+ */
+void scheduler_init(SchedulerTask *tasks, uint8_t count)
+{
+    systick_init();
+    uint32_t now = systick_millis();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        tasks[i].due = now;
+        tasks[i].worst = 0;
+        tasks[i].overruns = 0;
+    }
+}
+
+/*
+ * run the highest priority task that is due
+ * returns 1 when a task ran, 0 when nothing was due
+ */
+uint8_t scheduler_run(SchedulerTask *tasks, uint8_t count)
+{
+    uint32_t now = systick_millis();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SchedulerTask *task = &tasks[i];
+        uint32_t late = now - task->due;
+
+        if ((int32_t)late < 0)
+        {
+            continue;
+        }
+
+        uint16_t start = systick_now();
+        task->run();
+        uint16_t elapsed = systick_since(start); // run times over 262 ms wrap
+
+        if (elapsed > task->worst)
+        {
+            task->worst = elapsed;
+        }
+        if (late >= task->period || elapsed > (uint32_t)task->period * SYSTICK_TICKS_PER_MS)
+        {
+            task->overruns++;
+        }
+
+        // keep the rate, missed runs are dropped instead of run back to back
+        task->due += task->period;
+        if ((int32_t)(now - task->due) >= 0)
+        {
+            task->due = now + task->period;
+        }
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <inttypes.h>
+
+/*
+ * Cooperative fixed rate scheduler on the systick millisecond counter.
+ * Tasks are kept in a table ordered by priority, scheduler_run() runs the
+ * first task that is due, so a long low priority task delays the others
+ * by at most its own run time.
+ */
+typedef struct
+{
+    void (*run)(void);
+    uint16_t period;   // ms between two runs
+    uint32_t due;      // systick_millis() of the next run
+    uint16_t worst;    // longest run time in systick ticks
+    uint16_t overruns; // runs started a period late or longer than a period
+} SchedulerTask;
+
+#define SCHEDULER_TASK(function, period) {function, period, 0, 0, 0}
+
+extern void scheduler_init(SchedulerTask *tasks, uint8_t count);
+extern uint8_t scheduler_run(SchedulerTask *tasks, uint8_t count);
+
+#endif
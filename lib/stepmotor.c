@@ -11,12 +11,259 @@ Modify by Yefri Gonzalez (Th3Cod3)
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "stepmotor.h"
 #include "debug.h"
 
+// first interval of a ramp is c0 = 0.676 * f * sqrt(2 / a), AVR446 eq. 15
+#define STEPMOTOR_C0_SCALE ((uint32_t)(0.676 * 1.41421356 * STEPMOTOR_TICKS_PER_SECOND))
+
+#if STEPMOTOR_QUEUE_SIZE & (STEPMOTOR_QUEUE_SIZE - 1)
+#error STEPMOTOR_QUEUE_SIZE must be a power of two
+#endif
+
+#define STEPMOTOR_QUEUE_MASK (STEPMOTOR_QUEUE_SIZE - 1)
+
+// ramp phase of the planner
+#define STEPMOTOR_ACCEL 1
+#define STEPMOTOR_RUN 2
+#define STEPMOTOR_DECEL 3
+
+// state of the step interrupt
+#define STEPMOTOR_IDLE 0
+#define STEPMOTOR_STEPPING 1
+#define STEPMOTOR_FINISHING 2 // last step is out, the timer stops on the next compare
+
+typedef struct
+{
+    uint16_t steps;
+    uint16_t interval; // ticks from one step to the next
+    int8_t direction;
+} StepMotorSegment;
+
+static StepMotor stepmotor_motor; // motor of the running move
+
+// segments from the planner (main loop) to the step interrupt
+static StepMotorSegment stepmotor_queue[STEPMOTOR_QUEUE_SIZE];
+static volatile uint8_t stepmotor_head = 0; // written by the main loop only
+static volatile uint8_t stepmotor_tail = 0; // written by the step interrupt only
+static volatile uint8_t stepmotor_epoch = 0; // counts stepmotor_stop(), a plan of an older epoch is dropped
+
+// step interrupt
+static volatile uint8_t stepmotor_state = STEPMOTOR_IDLE;
+static int8_t stepmotor_direction;
+static uint16_t stepmotor_steps;    // steps left in the current segment
+static uint16_t stepmotor_interval; // ticks until the next step
+#if STEPMOTOR_HW_PULSE
+static uint8_t stepmotor_high;      // level of the step pin after the last compare
+#else
+static uint16_t stepmotor_wait;     // ticks still to count before the next step
+#endif
+
+// planner, only used from the main loop
+static uint8_t stepmotor_plan_epoch;
+static uint8_t stepmotor_plan_phase;
+static int8_t stepmotor_plan_direction;
+static uint32_t stepmotor_plan_remaining;    // steps not yet queued
+static uint32_t stepmotor_plan_decel_at;     // remaining steps where deceleration starts
+static uint32_t stepmotor_plan_interval;     // ticks after the next step
+static uint32_t stepmotor_plan_interval_min; // ticks at speedMax
+static uint32_t stepmotor_plan_rest;         // remainder of the interval division
+static int32_t stepmotor_plan_n;             // ramp step counter, negative while decelerating
+static uint8_t stepmotor_plan_started;       // a segment of the ramp was queued
+
+static uint16_t stepmotor_sqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/*
+ * take the next segment from the queue, call from the step interrupt
+ * returns 0 when the queue is empty
+ */
+static uint8_t stepmotor_next(void)
+{
+    uint8_t tail = stepmotor_tail;
+
+    if (tail == stepmotor_head)
+        return 0;
+
+    StepMotorSegment *segment = &stepmotor_queue[tail];
+    if (segment->direction != stepmotor_direction)
+    {
+        // the drivers latch the direction on the next rising step edge
+        stepmotor_direction = segment->direction;
+        if (stepmotor_direction > 0)
+        {
+            *stepmotor_motor.portMoveDir |= _BV(stepmotor_motor.pinMoveDir);
+            *stepmotor_motor.portGrapDir |= _BV(stepmotor_motor.pinGrapDir);
+        }
+        else
+        {
+            *stepmotor_motor.portMoveDir &= ~_BV(stepmotor_motor.pinMoveDir);
+            *stepmotor_motor.portGrapDir &= ~_BV(stepmotor_motor.pinGrapDir);
+        }
+    }
+    stepmotor_steps = segment->steps;
+    stepmotor_interval = segment->interval;
+    stepmotor_tail = (tail + 1) & STEPMOTOR_QUEUE_MASK; // release the entry after the copy
+    return 1;
+}
+
+/*
+ * bookkeeping of a step that was just sent
+ * returns 0 when the queue ran empty and this was the last step
+ */
+static uint8_t stepmotor_advance(void)
+{
+    if (stepmotor_motor.position)
+        *stepmotor_motor.position += stepmotor_direction;
+
+    if (--stepmotor_steps == 0 && !stepmotor_next())
+    {
+        stepmotor_state = STEPMOTOR_FINISHING;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * stop the timer after the last step, the queue and the plan are kept
+ */
+static void stepmotor_halt(void)
+{
+    stepmotor_disable_timer();
+    stepmotor_state = STEPMOTOR_IDLE;
+#if !STEPMOTOR_HW_PULSE
+    stepmotor_wait = 0;
+#endif
+}
+
+static uint8_t stepmotor_limit_hit(void)
+{
+    return stepmotor_motor.ddrLimit && !(*stepmotor_motor.pinLimit & _BV(stepmotor_motor.limit));
+}
+
+#if STEPMOTOR_HW_PULSE
+
+/*
+ * next compare ticks after the one that raised the interrupt, a compare the
+ * counter has already passed would only match after a wrap
+ */
+static void stepmotor_schedule(uint16_t ticks)
+{
+    uint16_t late = TCNT5 - OCR5A; // ticks since the compare
+
+    if (late + STEPMOTOR_LEAD >= ticks)
+        OCR5A = TCNT5 + STEPMOTOR_LEAD;
+    else
+        OCR5A += ticks;
+}
+
+/*
+ * The compare unit toggles the step pin, one step is a high and a low half
+ * of the interval. Only the grip stepper pin is set in software.
+ */
+ISR(STEPMOTOR_TIMER_vect)
+{
+    stepmotor_high = !stepmotor_high;
+
+    if (stepmotor_high)
+    {
+        // rising edge, the step is out
+        *stepmotor_motor.portGrapStep |= _BV(stepmotor_motor.pinGrapStep);
+        if (stepmotor_limit_hit())
+        {
+            stepmotor_stop();
+            return;
+        }
+        stepmotor_advance();
+        stepmotor_schedule(stepmotor_interval >> 1);
+    }
+    else
+    {
+        *stepmotor_motor.portGrapStep &= ~_BV(stepmotor_motor.pinGrapStep);
+        if (stepmotor_state == STEPMOTOR_FINISHING)
+        {
+            stepmotor_halt();
+            return;
+        }
+        stepmotor_schedule(stepmotor_interval - (stepmotor_interval >> 1));
+    }
+}
+
+#else
+
+/*
+ * count the next part of ticks, at most 256
+ * the last part is kept long enough to be set before the timer passes it
+ */
+static void stepmotor_count(uint16_t ticks)
+{
+    uint16_t part = ticks;
+
+    if (ticks >= 256 + STEPMOTOR_INTERVAL_MIN)
+        part = 256;
+    else if (ticks > 256)
+        part = ticks - STEPMOTOR_INTERVAL_MIN;
+    stepmotor_wait = ticks - part;
+    OCR0A = part - 1;
+}
+
+ISR(STEPMOTOR_TIMER_vect)
+{
+    if (stepmotor_wait)
+    {
+        stepmotor_count(stepmotor_wait);
+        return;
+    }
+
+    if (stepmotor_state == STEPMOTOR_FINISHING)
+    {
+        stepmotor_halt();
+        return;
+    }
+    if (stepmotor_limit_hit())
+    {
+        stepmotor_stop();
+        return;
+    }
+
+    *stepmotor_motor.portMoveStep |= _BV(stepmotor_motor.pinMoveStep);
+    *stepmotor_motor.portGrapStep |= _BV(stepmotor_motor.pinGrapStep);
+
+    if (stepmotor_advance())
+        stepmotor_count(stepmotor_interval);
+
+    // the bookkeeping above is long enough for the step pulse width
+    *stepmotor_motor.portMoveStep &= ~_BV(stepmotor_motor.pinMoveStep);
+    *stepmotor_motor.portGrapStep &= ~_BV(stepmotor_motor.pinGrapStep);
+}
+
+#endif
+
 uint8_t stepmotor_pending_step()
 {
-    return !(TIFR0 & _BV(TOV0));
+    return stepmotor_state != STEPMOTOR_IDLE || stepmotor_head != stepmotor_tail ||
+           (stepmotor_plan_remaining && stepmotor_plan_epoch == stepmotor_epoch);
 }
 
 uint8_t stepmotor_end_limit(StepMotor motor)
@@ -28,44 +275,262 @@ uint8_t stepmotor_end_limit(StepMotor motor)
     return !(*motor.pinLimit & _BV(motor.limit));
 }
 
+#if STEPMOTOR_HW_PULSE
+
+static void stepmotor_arm(void)
+{
+    // force the output latch low, then let every compare toggle the pin
+    TCCR5A = _BV(COM5A1);
+    TCCR5C = _BV(FOC5A);
+    TCCR5A = _BV(COM5A0);
+    stepmotor_high = 0;
+    TCNT5 = 0;
+    TIFR5 = _BV(OCF5A);
+    TIMSK5 |= _BV(OCIE5A);
+}
+
+void stepmotor_disable_timer()
+{
+    TIMSK5 &= ~_BV(OCIE5A);
+    TCCR5A = 0; // the pin follows PORT again, which is low
+}
+
+#else
+
+static void stepmotor_arm(void)
+{
+    TCNT0 = 0;
+    TIFR0 = _BV(OCF0A);
+    TIMSK0 |= _BV(OCIE0A);
+}
+
+void stepmotor_disable_timer()
+{
+    TIMSK0 &= ~_BV(OCIE0A);
+}
+
+#endif
+
 void stepmotor_enable_timer()
 {
-    TIMSK0 |= _BV(TOIE0) | _BV(OCIE0A);
+    stepmotor_arm();
     sei();
 }
 
-void stepmotor_disable_timer()
+/*
+ * start the timer on the first queued segment when it is not running
+ */
+static void stepmotor_start(void)
+{
+    // a stop from an interrupt empties the queue, so it cannot be undone here
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (stepmotor_state == STEPMOTOR_IDLE && stepmotor_next())
+        {
+            stepmotor_state = STEPMOTOR_STEPPING;
+            // the first step follows after a minimal interval
+#if STEPMOTOR_HW_PULSE
+            OCR5A = STEPMOTOR_INTERVAL_MIN; // the counter restarts at 0
+#else
+            stepmotor_wait = 0;
+            OCR0A = STEPMOTOR_INTERVAL_MIN - 1;
+#endif
+            stepmotor_arm();
+        }
+    }
+}
+
+/*
+ * interval for the step after the one just planned, stepmotor_plan_remaining
+ * has already been counted down and is not 0
+ */
+static void stepmotor_plan_update(void)
+{
+    if (stepmotor_plan_phase != STEPMOTOR_DECEL && stepmotor_plan_remaining <= stepmotor_plan_decel_at)
+    {
+        // brake over the remaining steps, n counts up to -1 on the last one
+        stepmotor_plan_phase = STEPMOTOR_DECEL;
+        stepmotor_plan_n = -(int32_t)stepmotor_plan_remaining - 1;
+    }
+
+    if (stepmotor_plan_phase != STEPMOTOR_RUN)
+    {
+        // c(n) = c(n-1) - 2 c(n-1) / (4n + 1), AVR446 eq. 22 with the remainder kept
+        stepmotor_plan_n++;
+        int32_t denominator = 4 * stepmotor_plan_n + 1;
+        int32_t delta = ((int32_t)(2 * stepmotor_plan_interval + stepmotor_plan_rest)) / denominator;
+        stepmotor_plan_rest = ((int32_t)(2 * stepmotor_plan_interval + stepmotor_plan_rest)) % denominator;
+        stepmotor_plan_interval -= delta;
+        if (stepmotor_plan_phase == STEPMOTOR_ACCEL && stepmotor_plan_interval <= stepmotor_plan_interval_min)
+        {
+            stepmotor_plan_interval = stepmotor_plan_interval_min;
+            stepmotor_plan_phase = STEPMOTOR_RUN;
+        }
+    }
+    if (stepmotor_plan_interval > STEPMOTOR_INTERVAL_MAX)
+        stepmotor_plan_interval = STEPMOTOR_INTERVAL_MAX;
+}
+
+/*
+ * cut the next segment from the plan: the whole cruise at once, the ramps
+ * in parts of STEPMOTOR_RAMP_STEPS at their mean interval
+ */
+static void stepmotor_plan_segment(StepMotorSegment *segment)
+{
+    uint32_t steps;
+    uint32_t interval;
+
+    if (stepmotor_plan_phase == STEPMOTOR_RUN)
+    {
+        steps = stepmotor_plan_remaining - stepmotor_plan_decel_at;
+        if (steps > 0xFFFF)
+            steps = 0xFFFF;
+        interval = stepmotor_plan_interval;
+        stepmotor_plan_remaining -= steps;
+        if (stepmotor_plan_remaining)
+            stepmotor_plan_update();
+    }
+    else
+    {
+        uint8_t phase = stepmotor_plan_phase;
+        steps = 0;
+        interval = 0;
+        do
+        {
+            interval += stepmotor_plan_interval;
+            steps++;
+            if (--stepmotor_plan_remaining)
+                stepmotor_plan_update();
+        } while (steps < STEPMOTOR_RAMP_STEPS && stepmotor_plan_remaining && stepmotor_plan_phase == phase);
+        interval /= steps;
+    }
+
+    segment->steps = steps;
+    segment->interval = interval < STEPMOTOR_INTERVAL_MIN ? STEPMOTOR_INTERVAL_MIN : interval;
+    segment->direction = stepmotor_plan_direction;
+}
+
+/*
+ * plan the remaining steps as a ramp from standstill
+ */
+static void stepmotor_plan_ramp(void)
 {
-    TIMSK0 &= ~(_BV(TOIE0) | _BV(OCIE0A));
+    // steps to reach speedMax, v^2 / 2a, at most half of the move
+    uint32_t accelSteps = (uint32_t)stepmotor_motor.speedMax * stepmotor_motor.speedMax / (2UL * stepmotor_motor.acceleration);
+    if (accelSteps > stepmotor_plan_remaining / 2)
+        accelSteps = stepmotor_plan_remaining / 2;
+
+    stepmotor_plan_decel_at = accelSteps;
+    stepmotor_plan_interval_min = STEPMOTOR_TICKS_PER_SECOND / stepmotor_motor.speedMax;
+    if (stepmotor_plan_interval_min < STEPMOTOR_INTERVAL_MIN)
+        stepmotor_plan_interval_min = STEPMOTOR_INTERVAL_MIN;
+    stepmotor_plan_interval = STEPMOTOR_C0_SCALE / stepmotor_sqrt(stepmotor_motor.acceleration);
+    if (stepmotor_plan_interval > STEPMOTOR_INTERVAL_MAX)
+        stepmotor_plan_interval = STEPMOTOR_INTERVAL_MAX;
+    if (stepmotor_plan_interval < stepmotor_plan_interval_min)
+        stepmotor_plan_interval = stepmotor_plan_interval_min;
+    stepmotor_plan_rest = 0;
+    stepmotor_plan_n = 0;
+    stepmotor_plan_phase = stepmotor_plan_interval == stepmotor_plan_interval_min ? STEPMOTOR_RUN : STEPMOTOR_ACCEL;
+    stepmotor_plan_started = 0;
+}
+
+/*
+ * move the planned steps into the segment queue and start the timer,
+ * call from the main loop often enough that the queue does not run empty
+ */
+void stepmotor_fill()
+{
+    // the queue ran empty before the move was done and the motor stands
+    // still, it starts over from the first ramp interval instead of at speed
+    if (stepmotor_plan_remaining && stepmotor_plan_started &&
+        stepmotor_state == STEPMOTOR_IDLE && stepmotor_head == stepmotor_tail)
+    {
+        stepmotor_plan_ramp();
+    }
+
+    while (stepmotor_plan_remaining)
+    {
+        uint8_t head = stepmotor_head;
+        uint8_t next = (head + 1) & STEPMOTOR_QUEUE_MASK;
+
+        if (next == stepmotor_tail)
+            break;
+
+        // the entry is not visible to the interrupt until head moves
+        stepmotor_plan_segment(&stepmotor_queue[head]);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (stepmotor_plan_epoch == stepmotor_epoch)
+            {
+                stepmotor_head = next;
+                stepmotor_plan_started = 1;
+            }
+            else
+                stepmotor_plan_remaining = 0; // stopped since the move was planned
+        }
+    }
+    stepmotor_start();
+}
+
+/*
+ * plan a move of steps (signed) with an acceleration ramp,
+ * a running move is replaced
+ */
+void stepmotor_move(StepMotor motor, int32_t steps)
+{
+    stepmotor_stop();
+    stepmotor_plan_remaining = 0;
+    if (!steps || !motor.speedMax || !motor.acceleration)
+    {
+        return;
+    }
+
+    stepmotor_motor = motor;
+    stepmotor_direction = 0; // the first segment sets the direction pins
+    stepmotor_plan_epoch = stepmotor_epoch;
+    if (steps > 0)
+    {
+        stepmotor_plan_direction = 1;
+    }
+    else
+    {
+        stepmotor_plan_direction = -1;
+        steps = -steps;
+    }
+    stepmotor_plan_remaining = steps;
+    stepmotor_plan_ramp();
+    stepmotor_fill();
+}
+
+/*
+ * stop at once, without deceleration, the queued segments and the rest
+ * of the planned move are dropped
+ */
+void stepmotor_stop()
+{
+    stepmotor_halt();
+    stepmotor_tail = stepmotor_head;
+    stepmotor_epoch++;
 }
 
 void stepmotor_instruction(StepMotor motor, char instruction)
 {
     if (stepmotor_pending_step())
     {
+        if (instruction == STEPMOTOR_STOP)
+            stepmotor_stop();
         return;
     }
 
     switch (instruction)
     {
     case STEPMOTOR_FORWARD:
-        if (stepmotor_end_limit(motor))
-            return stepmotor_instruction(motor, STEPMOTOR_STOP);
-        *motor.portMoveDir |= _BV(motor.pinMoveDir);
-        *motor.portMoveStep &= ~_BV(motor.pinMoveStep);
-        *motor.portGrapDir |= _BV(motor.pinGrapDir);
-        *motor.portGrapStep &= ~_BV(motor.pinGrapStep);
-        stepmotor_enable_timer();
+        stepmotor_move(motor, 1);
         return;
 
     case STEPMOTOR_BACKWARD:
-        if (stepmotor_end_limit(motor))
-            return stepmotor_instruction(motor, STEPMOTOR_STOP);
-        *motor.portMoveDir &= ~_BV(motor.pinMoveDir);
-        *motor.portMoveStep &= ~_BV(motor.pinMoveStep);
-        *motor.portGrapDir &= ~_BV(motor.pinGrapDir);
-        *motor.portGrapStep &= ~_BV(motor.pinGrapStep);
-        stepmotor_enable_timer();
+        stepmotor_move(motor, -1);
         return;
 
     case STEPMOTOR_STOP:
@@ -82,14 +547,18 @@ void stepmotor_init(StepMotor motor)
     *motor.ddrGrapStep |= _BV(motor.pinGrapStep); // output
     *motor.ddrMoveDir |= _BV(motor.pinMoveDir);   // output
     *motor.ddrMoveStep |= _BV(motor.pinMoveStep); // output
-    if (*motor.ddrLimit)
+    if (motor.ddrLimit)
     {
         *motor.ddrLimit &= ~_BV(motor.limit); // input
         *motor.portLimit |= _BV(motor.limit); // input
     }
-    TCCR0A = 0;
-    OCR0A = 125;
-    TCCR0B |= _BV(CS01);
-    stepmotor_enable_timer();
+#if STEPMOTOR_HW_PULSE
+    *motor.portMoveStep &= ~_BV(motor.pinMoveStep); // low while the compare unit is disconnected
+    TCCR5A = 0;
+    TCCR5B = _BV(CS51) | _BV(CS50); // normal mode, runs free, prescaler 64
+#else
+    TCCR0A = _BV(WGM01);            // CTC
+    TCCR0B = _BV(CS01) | _BV(CS00); // prescaler 64
+#endif
     stepmotor_instruction(motor, STEPMOTOR_STOP);
-}
\ No newline at end of file
+}
@@ -7,6 +7,42 @@
 #define STEPMOTOR_GRAP 3
 #define STEPMOTOR_RELEASE 3
 
+/*
+ * Steps are timed with prescaler 64 (4 us at 16 MHz).
+ * Moves accelerate and decelerate with the integer ramp of Atmel AVR446.
+ * The ramp is planned in the main loop and cut into segments of a step
+ * count, an interval and a direction. The step interrupt only counts the
+ * segments off the queue, it runs on its own until the queue is empty.
+ * stepmotor_fill() tops the queue up from the plan.
+ *
+ * STEPMOTOR_HW_PULSE 0: Timer0 in CTC mode interrupts for every step and
+ * sets the step pins in software. The timer is 8 bit, longer intervals are
+ * counted in parts of 256 ticks.
+ * STEPMOTOR_HW_PULSE 1: Timer5 runs free and toggles the move step pin,
+ * which has to be OC5A (PL3). Every compare interrupt adds the next half
+ * interval to OCR5A, so the edges keep their timing as long as the
+ * interrupt starts within that half interval. A later start, for example
+ * behind the control interrupt, puts the edge STEPMOTOR_LEAD ticks after
+ * the interrupt instead of waiting a full timer wrap (262 ms).
+ * The grip step pin follows from the compare interrupt.
+ */
+#ifndef STEPMOTOR_HW_PULSE
+#define STEPMOTOR_HW_PULSE 0
+#endif
+
+#if STEPMOTOR_HW_PULSE
+#define STEPMOTOR_TIMER_vect TIMER5_COMPA_vect
+#else
+#define STEPMOTOR_TIMER_vect TIMER0_COMPA_vect
+#endif
+#define STEPMOTOR_TIMER_PRESCALER 64
+#define STEPMOTOR_TICKS_PER_SECOND (F_CPU / STEPMOTOR_TIMER_PRESCALER)
+#define STEPMOTOR_INTERVAL_MIN 32     // ticks, leaves time for the step interrupt itself
+#define STEPMOTOR_LEAD 2              // ticks, earliest compare after a late interrupt
+#define STEPMOTOR_INTERVAL_MAX 0xFFFF // ticks, slowest step is 262 ms apart
+#define STEPMOTOR_QUEUE_SIZE 16       // segments, power of two
+#define STEPMOTOR_RAMP_STEPS 8        // steps per segment while accelerating or braking
+
 typedef struct
 {
     volatile uint8_t *ddrMoveDir;
@@ -25,6 +61,9 @@ typedef struct
     volatile uint8_t *portLimit;
     volatile uint8_t *pinLimit;
     uint8_t limit;
+    volatile int32_t *position; // counted by the step interrupt, 0 when not used
+    uint16_t speedMax;          // steps/s
+    uint16_t acceleration;      // steps/s^2, also used to decelerate
 } StepMotor;
 
 extern uint8_t stepmotor_pending_step();
@@ -32,6 +71,9 @@ extern uint8_t stepmotor_start_limit(StepMotor motor);
 extern uint8_t stepmotor_end_limit(StepMotor motor);
 extern void stepmotor_enable_timer();
 extern void stepmotor_disable_timer();
+extern void stepmotor_move(StepMotor motor, int32_t steps);
+extern void stepmotor_fill();
+extern void stepmotor_stop();
 extern void stepmotor_instruction(StepMotor motor, char instruction);
 extern void stepmotor_init(StepMotor motor);
 
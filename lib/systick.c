@@ -0,0 +1,72 @@
+/*
+systick lib 0x01
+
+Timer1 time base
+
+Released under GPLv3.
+Please refer to LICENSE file for licensing information.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "systick.h"
+
+static volatile uint32_t systick_ms = 0;
+
+ISR(TIMER1_COMPB_vect)
+{
+    OCR1B += SYSTICK_TICKS_PER_MS;
+    systick_ms++;
+}
+
+/*
+ * start the free running counter, safe to call more than once
+ */
+void systick_init(void)
+{
+    if (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10)))
+    {
+        return;
+    }
+    TCCR1A = 0;
+    OCR1B = SYSTICK_TICKS_PER_MS;
+    TIMSK1 |= _BV(OCIE1B);
+    TCCR1B = _BV(CS11) | _BV(CS10); // normal mode, prescaler 64
+    sei();
+}
+
+/*
+ * current timestamp in ticks
+ */
+uint16_t systick_now(void)
+{
+    uint16_t now;
+    // TCNT1 is read through the shared TEMP register
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = TCNT1;
+    }
+    return now;
+}
+
+/*
+ * milliseconds since systick_init()
+ */
+uint32_t systick_millis(void)
+{
+    uint32_t ms;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ms = systick_ms;
+    }
+    return ms;
+}
+
+/*
+ * ticks passed since a timestamp, valid up to one counter wrap
+ */
+uint16_t systick_since(uint16_t timestamp)
+{
+    return systick_now() - timestamp;
+}
@@ -0,0 +1,22 @@
+#ifndef SYSTICK_H
+#define SYSTICK_H
+
+#include <inttypes.h>
+
+/*
+ * Timer1 runs free with prescaler 64 and is used as time base,
+ * one tick is 4 us at 16 MHz and the counter wraps every 262 ms.
+ * Compare unit B interrupts every millisecond to count systick_millis().
+ */
+#define SYSTICK_PRESCALER 64
+#define SYSTICK_TICKS_PER_MS (F_CPU / SYSTICK_PRESCALER / 1000)
+
+// convert microseconds to ticks, rounded up
+#define SYSTICK_US(us) ((uint16_t)(((uint32_t)(us) * SYSTICK_TICKS_PER_MS + 999) / 1000))
+
+extern void systick_init(void);
+extern uint16_t systick_now(void);
+extern uint16_t systick_since(uint16_t timestamp);
+extern uint32_t systick_millis(void);
+
+#endif
@@ -1,8 +1,19 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "lib/lcdpcf8574.h"
 #include "lib/dcmotor.h"
 #include "lib/stepmotor.h"
+#include "lib/systick.h"
+#include "lib/menu.h"
+#include "lib/quadrature.h"
+#include "lib/event.h"
+#include "lib/scheduler.h"
+#include "lib/pid.h"
+#include "lib/profile.h"
+#include "lib/planner.h"
+#include "lib/grid.h"
+#include "lib/job.h"
 #include "lib/debug.h"
 
 #define LCD_HIGH 0
@@ -17,537 +28,936 @@
 #define X_ENCODER_A PC6
 #define X_ENCODER_B PC7
 
+#define X_MOTOR_PWM PH3 // OC4A
+#define Y_MOTOR_PWM PH4 // OC4B
+
 #define Z_STEPPER_DIR PL2
 #define Z_STEPPER_STEP PL3
 #define GRIP_STEPPER_DIR PL1
 #define GRIP_STEPPER_STEP PL0
+#define Z_SPEED_MAX 2000    // steps/s
+#define Z_ACCELERATION 4000 // steps/s^2
+#define Z_BLEND ((uint32_t)Z_SPEED_MAX * Z_SPEED_MAX / (4 * Z_ACCELERATION)) // steps, half the braking distance from full speed
+
+#define LIMIT_MASK (_BV(PA0) | _BV(PA1) | _BV(PA2) | _BV(PA3)) // X/Y limit switches, active low
+
+/*
+ * X/Y encoders are sampled from the Timer2 compare interrupt and counted
+ * on every edge (4 counts per cycle). Every quadrature state has to be
+ * seen at least once, so an axis can be tracked up to ENCODER_SAMPLE_RATE
+ * edges/s (5000 cycles/s at 20 kHz). Keep a margin for the latency of the
+ * other interrupts, missed edges show up in Quadrature.errors.
+ */
+#define ENCODER_SAMPLE_RATE 20000UL
+#define ENCODER_TIMER_PRESCALER 8
+#define BUTTON_DEBOUNCE_SAMPLES 100 // stable samples before the button changes, 5 ms
+
+/*
+ * Axis positions are signed counts: encoder edges for X/Y, steps for Z.
+ * The scale of each axis is given in counts per millimetre as Q8.8 fixed
+ * point, setpoints entered in the menu are converted with it.
+ */
+#define AXIS_COUNT 3
+#define AXES_ALL (_BV(AXIS_COUNT) - 1)
+#define AXIS_SCALE(countsPerMm) ((uint16_t)((countsPerMm) * 256 + 0.5))
+#define X_COUNTS_PER_MM AXIS_SCALE(20.0)
+#define Y_COUNTS_PER_MM AXIS_SCALE(20.0)
+#define Z_COUNTS_PER_MM AXIS_SCALE(25.0)
+
+/*
+ * Travel of the crane in mm, Z counts down from the home at the top to
+ * the floor. A grid run waits GRIP_TIME at the bottom for the gripper to
+ * close or open, its stepper is driven together with Z.
+ */
+#define X_TRAVEL 400 // mm
+#define Y_TRAVEL 300 // mm
+#define Z_FLOOR 200  // mm
+#define GRIP_TIME 500 // ms
+
+/*
+ * X/Y position control runs from the Timer1 compare C interrupt at
+ * POSITION_CONTROL_RATE. The gains act on the error in encoder counts
+ * per control period, PID_OUTPUT_MIN is the lowest speed that still
+ * moves the carriage.
+ */
+#define POSITION_CONTROL_RATE 1000UL // Hz
+#define PID_KP PID_GAIN(4.0)
+#define PID_KI PID_GAIN(0.02)
+#define PID_KD PID_GAIN(8.0)
+#define PID_OUTPUT_MIN (DCMOTOR_SPEED_MAX / 5)
+#define PID_WINDOW 2 // counts
+
+/*
+ * Moves follow a velocity profile so the load does not swing, the PID
+ * tracks the profile setpoint instead of jumping to the target.
+ */
+#define XY_VELOCITY 400     // counts/s
+#define XY_ACCELERATION 800 // counts/s^2
+#define PROFILE_VELOCITY_MAX PROFILE_VELOCITY(XY_VELOCITY, POSITION_CONTROL_RATE)
+#define PROFILE_ACCELERATION_MAX PROFILE_ACCELERATION(XY_ACCELERATION, POSITION_CONTROL_RATE)
+#define PROFILE_SMOOTHING 5 // S-curve over 32 ms
+
+/*
+ * COORDINATED_MOVES 1: X, Y and Z travel one straight line. A single
+ * path profile drives the interpolator for the X/Y setpoints and the Z
+ * ramp is scaled to the same duration, the slowest axis sets the pace.
+ * New targets are queued behind the running move, consecutive X/Y moves
+ * pass their corners at up to JUNCTION_JUMP on every axis.
+ * COORDINATED_MOVES 0: every axis moves to its setpoint on its own.
+ */
+#ifndef COORDINATED_MOVES
+#define COORDINATED_MOVES 1
+#endif
+#define JUNCTION_JUMP 100 // counts/s, largest step of an axis speed at a corner
 
-#define ENCODER_STATE_UNKNOWN 100
-#define ENCODER_STATE_NONE 0
-#define ENCODER_STATE_A 1
-#define ENCODER_STATE_B 2
-#define ENCODER_STATE_X 3
-#define ENCODER_STATE_LEFT 4
-#define ENCODER_STATE_RIGHT 6
-#define ENCODER_STATE_BUTTON 7
-
-#define PROJECT_OPTION_NONE 0
-#define PROJECT_OPTION_DRIVE 1
-#define PROJECT_OPTION_CONFIG 2
-#define PROJECT_OPTION_INFO 3
-#define PROJECT_OPTION_DRIVE_MANUAL 11
-#define PROJECT_OPTION_DRIVE_GRID 12
-#define PROJECT_OPTION_CONFIG_CALIBRATION 21
-#define PROJECT_OPTION_CONFIG_BOX 22
-
-#define LCD_REFESH 1
-#define LCD_NO_REFESH 2
+// task periods in ms
+#define CONTROL_PERIOD 1
+#define UI_PERIOD 5
+#define LCD_PUMP_PERIOD 2
+#define TELEMETRY_PERIOD 1000
+
+#define LCD_PUMP_CELLS 2 // cells sent per lcd_pump() call
 
 //             {"Kraan naar A0"},
 //     {"Calibratie", "Doos", "Terug"},
 //         {"Verplaats x->", "Verplaats y->", "Verplaats z->"},
 //         {"l=", "h=", "d=", "Terug"},
 
-uint8_t position[] = {0, 0, 0};
-uint8_t moveToPosition[] = {0, 0, 0};
+volatile int32_t position[] = {0, 0, 0}; // written from the encoder and step interrupts
+volatile int32_t moveToPosition[] = {0, 0, 0}; // X/Y are read by the control interrupt
+int16_t setpoint[] = {0, 0, 0}; // manual setpoints in mm
+const uint16_t countsPerMm[] = {X_COUNTS_PER_MM, Y_COUNTS_PER_MM, Z_COUNTS_PER_MM};
 uint8_t boxDimension[] = {10, 10, 10};
 uint8_t boxMargin[] = {10, 10, 10};
 uint8_t grid[] = {0, 0};
-uint8_t tolerance = 2;
-uint8_t emergency = 0;
+const uint16_t travel[] = {X_TRAVEL, Y_TRAVEL, Z_FLOOR};
+const uint8_t limitHome[] = {_BV(PA1), _BV(PA3)}; // X/Y start limits, pressed at position 0
+const uint8_t limitEnd[] = {_BV(PA0), _BV(PA2)};
+volatile uint8_t emergency = 0; // set from the INT4 interrupt
 
-ISR(INT4_vect)
+// consistent copy of the state shared with the interrupts
+typedef struct
 {
-    emergency = 1;
+    int32_t position[AXIS_COUNT];
+    uint8_t emergency;
+} MachineState;
+
+DcMotor motorX, motorY;
+StepMotor motorZ;
+
+Pid pidX, pidY;
+Profile profileX, profileY;
+Planner planner;      // queued coordinated moves
+Grid gridMap;         // cell coordinates for boxDimension/boxMargin
+Job job;              // box transfers of a multi-cell grid run
+uint8_t jobRunning = 0; // the cells of job are being queued
+JobCell jobFrom;      // cell to pick up from, waits for the cell to put down in
+uint8_t jobFromSet = 0;
+uint8_t gridRun = 0;  // moves of a grid run or job are in the planner
+volatile uint8_t positionControl = 1; // 0 while the X/Y motors are driven directly
+volatile uint16_t controlWorst = 0;   // longest control interrupt in systick ticks
+uint8_t axesArrived = 0;              // axes that reached their setpoint, one bit per axis
+#if COORDINATED_MOVES
+uint8_t plannerEpoch = 0;             // planner resets handled by moveMotors()
+#endif
+
+Quadrature xEncoder, yEncoder, screenEncoder;
+
+void sampleScreenEncoder(uint8_t pins)
+{
+    static int8_t steps = 0;
+    static uint8_t pressed = 0;
+    static uint8_t debounce = 0;
+    uint8_t ab = QUADRATURE_AB(pins, LCD_ENCODER_A, LCD_ENCODER_B);
+
+    steps += quadrature_update(&screenEncoder, ab);
+
+    // one event per detent, the encoder rests with A and B released
+    if (ab == 0)
+    {
+        if (steps <= -QUADRATURE_EDGES_PER_CYCLE / 2)
+        {
+            event_push(EVENT_ENCODER, -1);
+        }
+        else if (steps >= QUADRATURE_EDGES_PER_CYCLE / 2)
+        {
+            event_push(EVENT_ENCODER, 1);
+        }
+        steps = 0;
+    }
+
+    if (!(pins & _BV(LCD_ENCODER_BUTTON)) == !pressed)
+    {
+        debounce = 0;
+    }
+    else if (++debounce >= BUTTON_DEBOUNCE_SAMPLES)
+    {
+        debounce = 0;
+        pressed = !pressed;
+        if (pressed)
+        {
+            event_push(EVENT_BUTTON, 0);
+        }
+    }
 }
 
-ISR(TIMER0_OVF_vect)
+void sampleLimits()
 {
-    stepmotor_disable_timer();
+    static uint8_t limits = 0;
+    uint8_t active = ~PINA & LIMIT_MASK;
+    uint8_t hit = active & ~limits;
+
+    limits = active;
+    // calibration drives into the switches on purpose
+    if (hit && positionControl)
+    {
+        event_push(EVENT_LIMIT, hit);
+    }
 }
 
-ISR(TIMER0_COMPA_vect)
+ISR(TIMER2_COMPA_vect)
 {
-    if (!emergency)
+    uint8_t pins = PINC;
+    position[0] += quadrature_update(&xEncoder, QUADRATURE_AB(pins, X_ENCODER_A, X_ENCODER_B));
+    position[1] += quadrature_update(&yEncoder, QUADRATURE_AB(pins, Y_ENCODER_A, Y_ENCODER_B));
+    sampleScreenEncoder(~pins); // active low
+    sampleLimits();
+}
+
+/*
+ * stand the controllers still at the measured position,
+ * call with interrupts off or from the control interrupt
+ */
+void holdControllers()
+{
+    pid_reset(&pidX, position[0]);
+    pid_reset(&pidY, position[1]);
+    profile_reset(&profileX, position[0]);
+    profile_reset(&profileY, position[1]);
+#if COORDINATED_MOVES
+    int32_t hold[] = {position[0], position[1], position[2]};
+    planner_reset(&planner, hold);
+#endif
+}
+
+// one period of the X/Y position control
+void controlStep()
+{
+    if (emergency || !positionControl)
     {
-        PORTL |= _BV(Z_STEPPER_STEP);
-        PORTL |= _BV(GRIP_STEPPER_STEP);
-        readZSteps();
+        // hold the controllers while the motors are stopped or driven directly
+        holdControllers();
+        if (emergency)
+        {
+            dcmotor_set_speed(motorX, 0);
+            dcmotor_set_speed(motorY, 0);
+        }
+        return;
     }
+#if COORDINATED_MOVES
+    planner_update(&planner);
+    dcmotor_set_speed(motorX, pid_update(&pidX, planner.line.position[0], position[0]));
+    dcmotor_set_speed(motorY, pid_update(&pidY, planner.line.position[1], position[1]));
+#else
+    dcmotor_set_speed(motorX, pid_update(&pidX, profile_update(&profileX, moveToPosition[0]), position[0]));
+    dcmotor_set_speed(motorY, pid_update(&pidY, profile_update(&profileY, moveToPosition[1]), position[1]));
+#endif
 }
 
-char menuText[][LCD_DISP_LENGTH + 1] = {"Besturing", "Instellingen", "Projectinfo"};
-char projectInfo[][LCD_DISP_LENGTH + 1] = {"Druk voor terug", "Projectinfo", "Naam project:", "Project Onshore", "Gemaakt door:", "Projectgroep B1", "Leden:", "-Roy -Hicham", "-Ivan -Yefri", "-Sebastiaan", "Druk voor terug"};
-char projectDrive[][LCD_DISP_LENGTH + 1] = {"Handmatig", "Raster", "Terug"};
-char projectDriveManual[][LCD_DISP_LENGTH + 1] = {"x=", "y=", "z=", "Terug"};
-char projectDriveGrid[][LCD_DISP_LENGTH + 1] = {"Raster=", "Starten", "Terug"};
-char projectConfig[][LCD_DISP_LENGTH + 1] = {"Calibratie", "Doos", "Terug"};
+ISR(TIMER1_COMPC_vect)
+{
+    uint16_t start = systick_now();
 
-const uint8_t optionsAmount = sizeof(menuText) / (LCD_DISP_LENGTH + 1);
-const uint8_t optionsInfoAmount = sizeof(projectInfo) / (LCD_DISP_LENGTH + 1);
-const uint8_t optionsConfigAmount = sizeof(projectConfig) / (LCD_DISP_LENGTH + 1);
-const uint8_t optionsDriveAmount = sizeof(projectDrive) / (LCD_DISP_LENGTH + 1);
-const uint8_t optionsDriveManualAmount = sizeof(projectDriveManual) / (LCD_DISP_LENGTH + 1);
-const uint8_t optionsDriveGridAmount = sizeof(projectDriveGrid) / (LCD_DISP_LENGTH + 1);
+    OCR1C += F_CPU / SYSTICK_PRESCALER / POSITION_CONTROL_RATE;
+    controlStep();
 
-uint8_t complement = 0;
+    // the other interrupts wait for this one, it sets their worst latency
+    uint16_t elapsed = systick_since(start);
+    if (elapsed > controlWorst)
+        controlWorst = elapsed;
+}
 
-void readScreenEncoder(uint8_t *lcdEncoderState)
+ISR(INT4_vect)
 {
-    uint8_t lcdEncoderA = !(PINC & _BV(LCD_ENCODER_A));
-    uint8_t lcdEncoderB = !(PINC & _BV(LCD_ENCODER_B));
-    uint8_t lcdEncoderButton = !(PINC & _BV(LCD_ENCODER_BUTTON));
+    // the motors stop here, the event only updates the screen and may be dropped
+    emergency = 1;
+    dcmotor_set_speed(motorX, 0);
+    dcmotor_set_speed(motorY, 0);
+    stepmotor_stop();
+    event_push(EVENT_EMERGENCY, 0);
+}
 
-    if (lcdEncoderButton)
+void readMachineState(MachineState *state)
+{
+    // all axes are copied at the same moment, the block only lasts for the copy (< 2 us)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        _delay_ms(1); // prevent debounce
-        *lcdEncoderState = ENCODER_STATE_BUTTON;
+        for (uint8_t i = 0; i < AXIS_COUNT; i++)
+        {
+            state->position[i] = position[i];
+        }
+        state->emergency = emergency;
     }
-    else if (*lcdEncoderState != ENCODER_STATE_NONE && !lcdEncoderA && !lcdEncoderB)
+}
+
+void resetPosition(uint8_t axis)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        *lcdEncoderState = ENCODER_STATE_NONE;
+        position[axis] = 0;
+        moveToPosition[axis] = 0;
+        holdControllers(); // start from the new origin, no control tick has to run first
     }
-    else if (*lcdEncoderState == ENCODER_STATE_NONE && lcdEncoderA && lcdEncoderB)
+    setpoint[axis] = 0;
+}
+
+int32_t millimetreToCounts(uint8_t axis, int16_t millimetre)
+{
+    return ((int32_t)millimetre * countsPerMm[axis] + 128) / 256;
+}
+
+/*
+ * a limit switch was hit during a move: the crane stands still where it
+ * is, a home switch is expected while its axis heads for 0
+ */
+void stopAtLimit(uint8_t hit)
+{
+    uint8_t unexpected = 0;
+    MachineState state;
+
+    for (uint8_t i = 0; i < 2; i++)
     {
-        return;
+        if ((hit & limitEnd[i]) || ((hit & limitHome[i]) && moveToPosition[i] > 0))
+            unexpected = 1;
     }
-    else if (lcdEncoderA && *lcdEncoderState == ENCODER_STATE_NONE)
+    if (!unexpected)
     {
-        *lcdEncoderState = ENCODER_STATE_A;
+        return;
     }
-    else if (lcdEncoderB && *lcdEncoderState == ENCODER_STATE_NONE)
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        *lcdEncoderState = ENCODER_STATE_B;
+        holdControllers();
     }
-    else if (lcdEncoderB && *lcdEncoderState == ENCODER_STATE_A)
+    readMachineState(&state);
+    for (uint8_t i = 0; i < 2; i++)
     {
-        *lcdEncoderState = ENCODER_STATE_LEFT;
+        // rounded away from the switch so the new setpoint does not press against it
+        int32_t counts = state.position[i] * 256;
+        if (!(hit & limitEnd[i]))
+            counts += countsPerMm[i] - 1;
+        setpoint[i] = counts / countsPerMm[i];
     }
-    else if (lcdEncoderA && *lcdEncoderState == ENCODER_STATE_B)
+    lcd_clrscr();
+    lcd_puts_P("Eindschakelaar");
+}
+
+void applySetpoints()
+{
+    for (uint8_t i = 0; i < AXIS_COUNT; i++)
     {
-        *lcdEncoderState = ENCODER_STATE_RIGHT;
+        int32_t counts = millimetreToCounts(i, setpoint[i]);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            moveToPosition[i] = counts;
+        }
     }
 }
 
-void readXEncoder()
+#if COORDINATED_MOVES
+
+#define CELL_MOVES 4 // queue entries of a cell visit: approach, lower, grip, lift
+
+/*
+ * queue a visit of a cell: approach, lower, wait for the gripper to pick
+ * up or put down the box, lift
+ * between the cells Z rises to Z_BLEND above gridMap.clear, X/Y already
+ * move while a lift brakes above it and until a lower comes down to it
+ * returns 0 when the cell is outside the grid
+ */
+uint8_t queueCell(uint8_t column, uint8_t row)
 {
-    static uint8_t xEncoderState = ENCODER_STATE_NONE;
-    static int8_t toleranceCounter = 0;
-    uint8_t xEncoderA = (PINC & _BV(X_ENCODER_A));
-    uint8_t xEncoderB = (PINC & _BV(X_ENCODER_B));
+    int32_t cell[AXIS_COUNT];
 
-    if (xEncoderState != ENCODER_STATE_NONE && !xEncoderA && !xEncoderB)
+    if (!grid_cell(&gridMap, column, row, cell))
     {
-        xEncoderState = ENCODER_STATE_NONE;
+        return 0;
     }
-    else if (xEncoderState == ENCODER_STATE_NONE && xEncoderA && xEncoderB)
+    uint16_t clearance = gridMap.clear > (int32_t)Z_BLEND ? Z_BLEND : gridMap.clear;
+    int32_t above[] = {cell[0], cell[1], gridMap.clear - clearance};
+    planner_push(&planner, above);
+    planner_push_clear(&planner, cell, clearance);
+    planner_dwell(&planner, GRIP_TIME * POSITION_CONTROL_RATE / 1000);
+    planner_push_clear(&planner, above, clearance);
+    return 1;
+}
+
+void queueHome()
+{
+    int32_t home[] = {0, 0, 0};
+
+    planner_push(&planner, home);
+    // the manual setpoints follow so they do not queue a move of their own
+    for (uint8_t i = 0; i < AXIS_COUNT; i++)
     {
-        return;
+        setpoint[i] = 0;
     }
-    else if (xEncoderA && xEncoderState == ENCODER_STATE_NONE)
+}
+
+// stop handing out cells, the crane goes home after the moves already queued
+void abortJob()
+{
+    jobRunning = 0;
+    job_clear(&job);
+    queueHome();
+    lcd_clrscr();
+    lcd_puts_P("Reeks gestopt");
+}
+
+/*
+ * queue the cells of the running job while the planner has room, every
+ * transfer visits its from and its to cell, home follows the last one
+ */
+void runJob()
+{
+    JobCell cell;
+
+    while (planner_free(&planner) >= CELL_MOVES)
     {
-        xEncoderState = ENCODER_STATE_A;
+        if (!job_next(&job, &cell))
+        {
+            queueHome();
+            job_clear(&job);
+            jobRunning = 0;
+            return;
+        }
+        if (!queueCell(cell.column, cell.row))
+        {
+            // a box that is skipped would leave the crane carrying it to the next cell
+            abortJob();
+            return;
+        }
     }
-    else if (xEncoderB && xEncoderState == ENCODER_STATE_NONE)
+}
+
+#endif
+
+void moveMotors(StepMotor motorZ)
+{
+    stepmotor_fill();
+    uint8_t zRunning = stepmotor_pending_step(); // before the snapshot, so a finished move is counted in it
+    MachineState state;
+    readMachineState(&state);
+
+    if (state.emergency)
     {
-        xEncoderState = ENCODER_STATE_B;
+        return;
     }
-    else if (xEncoderB && xEncoderState == ENCODER_STATE_A)
+
+    uint8_t inPosition = 0;
+#if COORDINATED_MOVES
+    // a reset drops the queue where the crane stands, a grid run caught between the boxes rises straight up first
+    if (planner.epoch != plannerEpoch)
     {
-        if (xEncoderState != ENCODER_STATE_LEFT && toleranceCounter == tolerance)
+        plannerEpoch = planner.epoch;
+        if (gridRun && state.position[2] > gridMap.clear)
         {
-            position[0]--;
-            toleranceCounter = 0;
+            int32_t lift[] = {state.position[0], state.position[1], gridMap.clear};
+            planner_push(&planner, lift);
         }
-        toleranceCounter++;
-        xEncoderState = ENCODER_STATE_LEFT;
-    }
-    else if (xEncoderA && xEncoderState == ENCODER_STATE_B)
-    {
-        if (xEncoderState != ENCODER_STATE_RIGHT && toleranceCounter == -tolerance)
+        if (jobRunning)
         {
-            position[0]++;
-            toleranceCounter = 0;
+            // the dropped moves belong to cells the job has already handed out
+            abortJob();
         }
-        toleranceCounter--;
-        xEncoderState = ENCODER_STATE_RIGHT;
     }
-}
 
-void readYEncoder()
-{
-    static uint8_t yEncoderState = ENCODER_STATE_NONE;
-    static int8_t toleranceCounter = 0;
-    uint8_t yEncoderA = (PINC & _BV(Y_ENCODER_A));
-    uint8_t yEncoderB = (PINC & _BV(Y_ENCODER_B));
+    // a changed target is queued behind the running moves, retried while the queue is full
+    int32_t target[] = {moveToPosition[0], moveToPosition[1], moveToPosition[2]};
+    if (jobRunning)
+        runJob();
+    else
+        planner_push(&planner, target);
 
-    if (yEncoderState != ENCODER_STATE_NONE && !yEncoderA && !yEncoderB)
+    // Z travel of the queued moves is started here, its ramp is planned in the main loop
+    PlannerMove *move = planner_z_ready(&planner);
+    if (move && !zRunning)
     {
-        yEncoderState = ENCODER_STATE_NONE;
+        motorZ.speedMax = move->zVelocity;
+        motorZ.acceleration = move->zAcceleration;
+        stepmotor_move(motorZ, move->target[2] - state.position[2]);
+        if (!planner_z_start(&planner))
+            stepmotor_stop();
+        zRunning = stepmotor_pending_step();
     }
-    else if (yEncoderState == ENCODER_STATE_NONE && yEncoderA && yEncoderB)
+    else if (!zRunning)
     {
-        return;
+        planner_z_done(&planner);
     }
-    else if (yEncoderA && yEncoderState == ENCODER_STATE_NONE)
+    else
     {
-        yEncoderState = ENCODER_STATE_A;
+        planner_z_clear(&planner, state.position[2]);
     }
-    else if (yEncoderB && yEncoderState == ENCODER_STATE_NONE)
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        yEncoderState = ENCODER_STATE_B;
+        uint8_t idle = planner_idle(&planner);
+        if (idle && pidX.inPosition)
+            inPosition |= _BV(0);
+        if (idle && pidY.inPosition)
+            inPosition |= _BV(1);
     }
-    else if (yEncoderB && yEncoderState == ENCODER_STATE_A)
+#else
+    // X/Y are driven by the control interrupt, Z runs a ramped move to the setpoint
+    if (!zRunning && state.position[2] != moveToPosition[2])
     {
-        if (yEncoderState != ENCODER_STATE_LEFT && toleranceCounter == tolerance)
-        {
-            position[1]--;
-            toleranceCounter = 0;
-        }
-        toleranceCounter++;
-        yEncoderState = ENCODER_STATE_LEFT;
+        stepmotor_move(motorZ, moveToPosition[2] - state.position[2]);
+        zRunning = 1;
     }
-    else if (yEncoderA && yEncoderState == ENCODER_STATE_B)
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        if (yEncoderState != ENCODER_STATE_RIGHT && toleranceCounter == -tolerance)
+        if (pidX.inPosition && profile_done(&profileX, moveToPosition[0]))
+            inPosition |= _BV(0);
+        if (pidY.inPosition && profile_done(&profileY, moveToPosition[1]))
+            inPosition |= _BV(1);
+    }
+#endif
+    if (!zRunning && state.position[2] == moveToPosition[2])
+        inPosition |= _BV(2);
+
+    for (uint8_t i = 0; i < AXIS_COUNT; i++)
+    {
+        if (inPosition & ~axesArrived & _BV(i))
         {
-            position[1]++;
-            toleranceCounter = 0;
+            event_post(EVENT_MOVE_DONE, i);
         }
-        toleranceCounter--;
-        yEncoderState = ENCODER_STATE_RIGHT;
     }
+    axesArrived = inPosition;
 }
 
-void readZSteps()
+void initPositionControl()
 {
-    if (PORTL & _BV(Z_STEPPER_STEP))
-    {
-        position[2]--;
-    }
-    else
+    pid_init(&pidX, PID_KP, PID_KI, PID_KD, DCMOTOR_SPEED_MAX, PID_OUTPUT_MIN, PID_WINDOW);
+    pid_init(&pidY, PID_KP, PID_KI, PID_KD, DCMOTOR_SPEED_MAX, PID_OUTPUT_MIN, PID_WINDOW);
+    profile_init(&profileX, PROFILE_VELOCITY_MAX, PROFILE_ACCELERATION_MAX, PROFILE_SMOOTHING);
+    profile_init(&profileY, PROFILE_VELOCITY_MAX, PROFILE_ACCELERATION_MAX, PROFILE_SMOOTHING);
+    planner_init(&planner, POSITION_CONTROL_RATE, XY_VELOCITY, XY_ACCELERATION,
+                 Z_SPEED_MAX, Z_ACCELERATION, JUNCTION_JUMP, PROFILE_SMOOTHING);
+
+    // compare unit C of the free running systick timer
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
     {
-        position[2]++;
+        OCR1C = TCNT1 + F_CPU / SYSTICK_PRESCALER / POSITION_CONTROL_RATE;
     }
+    TIMSK1 |= _BV(OCIE1C);
 }
 
-uint8_t moveOptionSelector(uint8_t *optionSelector, uint8_t lcdEncoderState, uint8_t totalOptions, uint8_t optionsOnScreen)
+void initEncoders()
 {
-    // -1 of the index and -1 complement = -2
-    if (lcdEncoderState == ENCODER_STATE_LEFT && (*optionSelector < totalOptions - optionsOnScreen || complement < optionsOnScreen - 1))
+    // Timer2 CTC mode, compare interrupt at ENCODER_SAMPLE_RATE
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A = F_CPU / ENCODER_TIMER_PRESCALER / ENCODER_SAMPLE_RATE - 1;
+    quadrature_init(&xEncoder, QUADRATURE_AB(PINC, X_ENCODER_A, X_ENCODER_B));
+    quadrature_init(&yEncoder, QUADRATURE_AB(PINC, Y_ENCODER_A, Y_ENCODER_B));
+    quadrature_init(&screenEncoder, QUADRATURE_AB(~PINC, LCD_ENCODER_A, LCD_ENCODER_B));
+    TIMSK2 |= _BV(OCIE2A);
+}
+
+void initEmergency(DcMotor motorX, DcMotor motorY, StepMotor motorZ)
+{
+    lcd_clrscr();
+    lcd_puts_P("NOODSITUATIE!!!");
+    dcmotor_instruction(motorX, DCMOTOR_STOP);
+    dcmotor_instruction(motorY, DCMOTOR_STOP);
+    stepmotor_instruction(motorZ, DCMOTOR_STOP);
+}
+
+uint8_t calibrate(void)
+{
+    lcd_clrscr();
+    lcd_puts_P("Bezig...");
+    lcd_flush();
+    positionControl = 0;
+    uint8_t homing = 1;
+    while (homing)
     {
-        if (complement < optionsOnScreen - 1)
+        // with the interrupts off a stop from INT4 cannot be overwritten
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
         {
-            complement++;
-        }
-        else
-        {
-            *optionSelector += 1;
+            uint8_t xHome = dcmotor_start_limit(motorX);
+            uint8_t yHome = dcmotor_start_limit(motorY);
+            dcmotor_instruction(motorX, xHome || emergency ? DCMOTOR_STOP : DCMOTOR_BACKWARD);
+            dcmotor_instruction(motorY, yHome || emergency ? DCMOTOR_STOP : DCMOTOR_BACKWARD);
+            homing = !emergency && !(xHome && yHome);
         }
     }
-    else if (lcdEncoderState == ENCODER_STATE_RIGHT && (*optionSelector || complement))
+    if (emergency)
     {
-        if (complement)
-        {
-            complement--;
-        }
-        else
-        {
-            *optionSelector -= 1;
-        }
+        // the emergency event shows the screen, the positions are not reset
+        positionControl = 1;
+        return MENU_KEEP;
     }
-    else
+    resetPosition(0);
+    resetPosition(1);
+    positionControl = 1;
+    lcd_clrscr();
+    lcd_puts_P("Start positie");
+    return MENU_KEEP;
+}
+
+#if COORDINATED_MOVES
+
+int16_t countsToMillimetre(uint32_t counts)
+{
+    // job distances are in X/Y counts, both axes have the same scale
+    return (counts * 256 + countsPerMm[0] / 2) / countsPerMm[0];
+}
+
+/*
+ * fetch the box of the selected cell and bring it home:
+ * approach, lower, grip, lift, retreat
+ */
+uint8_t startGrid(void)
+{
+    lcd_clrscr();
+    if (jobRunning || planner_free(&planner) < CELL_MOVES + 1)
     {
-        return LCD_NO_REFESH;
+        lcd_puts_P("Bezig...");
+        return MENU_KEEP;
     }
-
-    return LCD_REFESH;
+    if (!queueCell(grid[0], grid[1]))
+    {
+        lcd_puts_P("Buiten bereik");
+        return MENU_KEEP;
+    }
+    queueHome();
+    gridRun = 1;
+    lcd_puts_P("Kraan naar doos");
+    return MENU_KEEP;
 }
 
-void chooseOption(uint8_t *optionSelector, uint8_t *projectOption)
+/*
+ * add the selected cell to the job, the first time as the cell to pick
+ * the box up from, the second time as the cell to put it down in
+ */
+uint8_t addCell(void)
 {
-    uint8_t prevProjectOption = *projectOption;
-    if (*projectOption == PROJECT_OPTION_NONE)
+    JobCell cell = {grid[0], grid[1]};
+
+    lcd_clrscr();
+    if (jobRunning)
     {
-        switch ((*optionSelector) + complement)
-        {
-        case PROJECT_OPTION_DRIVE - 1:
-            *projectOption = PROJECT_OPTION_DRIVE;
-            break;
-        case PROJECT_OPTION_CONFIG - 1:
-            *projectOption = PROJECT_OPTION_CONFIG;
-            break;
-        case PROJECT_OPTION_INFO - 1:
-            *projectOption = PROJECT_OPTION_INFO;
-            break;
-        }
+        lcd_puts_P("Bezig...");
     }
-    else if (*projectOption == PROJECT_OPTION_DRIVE)
+    else if (job.count >= JOB_MOVES_MAX)
     {
-        switch ((*optionSelector) + complement)
-        {
-        case PROJECT_OPTION_DRIVE_MANUAL - 11:
-            *projectOption = PROJECT_OPTION_DRIVE_MANUAL;
-            break;
-        case PROJECT_OPTION_DRIVE_GRID - 11:
-            *projectOption = PROJECT_OPTION_DRIVE_GRID;
-            break;
-        default:
-            *projectOption = PROJECT_OPTION_NONE;
-            break;
-        }
+        lcd_puts_P("Reeks vol");
     }
-    else if (*projectOption == PROJECT_OPTION_INFO)
+    else if (cell.column >= gridMap.columns || cell.row >= gridMap.rows)
     {
-        *projectOption = PROJECT_OPTION_NONE;
+        lcd_puts_P("Buiten bereik");
     }
-    else if (*projectOption == PROJECT_OPTION_CONFIG)
+    else if (job_uses(&job, cell.column, cell.row) ||
+             (jobFromSet && jobFrom.column == cell.column && jobFrom.row == cell.row))
     {
-        switch ((*optionSelector) + complement)
-        {
-        case PROJECT_OPTION_CONFIG_CALIBRATION - 21:
-            *projectOption = PROJECT_OPTION_CONFIG_CALIBRATION;
-            break;
-        case PROJECT_OPTION_CONFIG_BOX - 21:
-            // *projectOption = PROJECT_OPTION_CONFIG_BOX;
-            break;
-        default:
-            *projectOption = PROJECT_OPTION_NONE;
-            break;
-        }
+        lcd_puts_P("Cel al in reeks");
     }
-    else if (*projectOption == PROJECT_OPTION_DRIVE_MANUAL || *projectOption == PROJECT_OPTION_DRIVE_GRID)
+    else if (!jobFromSet)
     {
+        jobFrom = cell;
+        jobFromSet = 1;
+        lcd_puts_P("Van gekozen");
+        lcd_gotoxy(0, 1);
+        lcd_puts_P("Kies doel");
     }
     else
     {
-        DEBUG_SIGNAL(10)
+        job_add(&job, &gridMap, &jobFrom, &cell);
+        jobFromSet = 0;
+        lcd_puts_P("Reeks: ");
+        lcd_puti(job.count);
+        lcd_puts_P(" dozen");
     }
+    return MENU_KEEP;
+}
 
-    if (prevProjectOption != *projectOption)
+/*
+ * order the transfers of the job for a short run and start it,
+ * shows the travel in the order added against the planned one
+ */
+uint8_t startJob(void)
+{
+    lcd_clrscr();
+    if (jobRunning)
+    {
+        lcd_puts_P("Bezig...");
+        return MENU_KEEP;
+    }
+    jobFromSet = 0; // a from cell without a cell to put down in is dropped
+    if (!job.count)
     {
-        complement = 0;
-        *optionSelector = 0;
+        lcd_puts_P("Reeks leeg");
+        return MENU_KEEP;
     }
+
+    job_plan(&job, &gridMap);
+    jobRunning = 1;
+    gridRun = 1;
+    lcd_puts_P("Naief   ");
+    lcd_puti(countsToMillimetre(job.naive));
+    lcd_puts_P(" mm");
+    lcd_gotoxy(0, 1);
+    lcd_puts_P("Gepland ");
+    lcd_puti(countsToMillimetre(job.planned));
+    lcd_puts_P(" mm");
+    return MENU_KEEP;
 }
 
-void changeOption(uint8_t *projectOption, uint8_t *optionSelector, uint8_t lcdEncoderState, DcMotor motorX, DcMotor motorY)
+#endif
+
+const char labelDrive[] PROGMEM = "Besturing";
+const char labelConfig[] PROGMEM = "Instellingen";
+const char labelInfo[] PROGMEM = "Projectinfo";
+const char labelManual[] PROGMEM = "Handmatig";
+const char labelGrid[] PROGMEM = "Raster";
+const char labelBack[] PROGMEM = "Terug";
+const char labelX[] PROGMEM = "x=";
+const char labelY[] PROGMEM = "y=";
+const char labelZ[] PROGMEM = "z=";
+const char labelColumn[] PROGMEM = "Kolom=";
+const char labelRow[] PROGMEM = "Rij=";
+const char labelStart[] PROGMEM = "Starten";
+const char labelAdd[] PROGMEM = "Erbij";
+const char labelJob[] PROGMEM = "Reeks";
+const char labelCalibration[] PROGMEM = "Calibratie";
+const char labelBox[] PROGMEM = "Doos";
+const char labelLength[] PROGMEM = "l=";
+const char labelHeight[] PROGMEM = "h=";
+const char labelDepth[] PROGMEM = "d=";
+const char labelPressBack[] PROGMEM = "Druk voor terug";
+const char labelProjectName[] PROGMEM = "Naam project:";
+const char labelProject[] PROGMEM = "Project Onshore";
+const char labelMadeBy[] PROGMEM = "Gemaakt door:";
+const char labelGroup[] PROGMEM = "Projectgroep B1";
+const char labelMembers[] PROGMEM = "Leden:";
+const char labelMembers1[] PROGMEM = "-Roy -Hicham";
+const char labelMembers2[] PROGMEM = "-Ivan -Yefri";
+const char labelMembers3[] PROGMEM = "-Sebastiaan";
+
+extern const MenuNode menuMain, menuDrive, menuConfig, menuInfo, menuManual, menuGrid, menuBox;
+
+const MenuItem menuMainItems[] PROGMEM = {
+    MENU_SUBMENU(labelDrive, &menuDrive),
+    MENU_SUBMENU(labelConfig, &menuConfig),
+    MENU_SUBMENU(labelInfo, &menuInfo),
+};
+const MenuItem menuDriveItems[] PROGMEM = {
+    MENU_SUBMENU(labelManual, &menuManual),
+    MENU_SUBMENU(labelGrid, &menuGrid),
+    MENU_BACK(labelBack),
+};
+const MenuItem menuManualItems[] PROGMEM = {
+    MENU_LENGTH(labelX, &setpoint[0]),
+    MENU_LENGTH(labelY, &setpoint[1]),
+    MENU_LENGTH(labelZ, &setpoint[2]),
+    MENU_BACK(labelBack),
+};
+const MenuItem menuGridItems[] PROGMEM = {
+    MENU_LETTER(labelColumn, &grid[0]),
+    MENU_NUMBER(labelRow, &grid[1]),
+#if COORDINATED_MOVES
+    MENU_ACTION(labelStart, startGrid),
+    MENU_ACTION(labelAdd, addCell),
+    MENU_ACTION(labelJob, startJob),
+#endif
+    MENU_BACK(labelBack),
+};
+const MenuItem menuConfigItems[] PROGMEM = {
+    MENU_ACTION(labelCalibration, calibrate),
+    MENU_SUBMENU(labelBox, &menuBox),
+    MENU_BACK(labelBack),
+};
+const MenuItem menuBoxItems[] PROGMEM = {
+    MENU_NUMBER(labelLength, &boxDimension[0]),
+    MENU_NUMBER(labelHeight, &boxDimension[1]),
+    MENU_NUMBER(labelDepth, &boxDimension[2]),
+    MENU_BACK(labelBack),
+};
+const MenuItem menuInfoItems[] PROGMEM = {
+    MENU_TEXT(labelPressBack),
+    MENU_TEXT(labelInfo),
+    MENU_TEXT(labelProjectName),
+    MENU_TEXT(labelProject),
+    MENU_TEXT(labelMadeBy),
+    MENU_TEXT(labelGroup),
+    MENU_TEXT(labelMembers),
+    MENU_TEXT(labelMembers1),
+    MENU_TEXT(labelMembers2),
+    MENU_TEXT(labelMembers3),
+    MENU_TEXT(labelPressBack),
+};
+
+const MenuNode menuMain PROGMEM = MENU_NODE(menuMainItems, MENU_LAYOUT_LIST, 0);
+const MenuNode menuDrive PROGMEM = MENU_NODE(menuDriveItems, MENU_LAYOUT_LIST, &menuMain);
+const MenuNode menuManual PROGMEM = MENU_NODE(menuManualItems, MENU_LAYOUT_FIELDS, &menuDrive);
+const MenuNode menuGrid PROGMEM = MENU_NODE(menuGridItems, MENU_LAYOUT_FIELDS, &menuDrive);
+const MenuNode menuConfig PROGMEM = MENU_NODE(menuConfigItems, MENU_LAYOUT_LIST, &menuMain);
+const MenuNode menuBox PROGMEM = MENU_NODE(menuBoxItems, MENU_LAYOUT_FIELDS, &menuConfig);
+const MenuNode menuInfo PROGMEM = MENU_NODE(menuInfoItems, MENU_LAYOUT_TEXT, &menuMain);
+
+uint8_t menuEvent(const Event *event)
 {
-    uint8_t optionsOnScreen = 2;
-    if (lcdEncoderState == ENCODER_STATE_BUTTON)
+    switch (event->type)
     {
-        chooseOption(optionSelector, projectOption);
+    case EVENT_ENCODER:
+        return event->data < 0 ? MENU_EVENT_NEXT : MENU_EVENT_PREVIOUS;
+    case EVENT_BUTTON:
+        return MENU_EVENT_SELECT;
     }
+    return MENU_EVENT_NONE;
+}
 
-    if (*projectOption == PROJECT_OPTION_NONE)
+// an axis reached its setpoint, a grid run is over once the crane is home
+void moveDone()
+{
+#if COORDINATED_MOVES
+    // a job hands out its last cell before it is done, a reset still has to queue its lift
+    if (gridRun && !jobRunning && axesArrived == AXES_ALL && planner.epoch == plannerEpoch)
     {
-        moveOptionSelector(optionSelector, lcdEncoderState, optionsAmount, optionsOnScreen);
-        for (uint8_t i = 0; i < 2; i++)
-        {
-            !i ? lcd_clrscr() : lcd_gotoxy(0, 1);
-            complement - i ? lcd_putc('-') : lcd_putc('>');
-            lcd_puts(menuText[*optionSelector + i]);
-        }
+        gridRun = 0;
+        lcd_clrscr();
+        lcd_puts_P("Klaar");
     }
-    else if (*projectOption == PROJECT_OPTION_DRIVE)
+#endif
+}
+
+void handleEvent(const Event *event)
+{
+    if (event->type == EVENT_EMERGENCY)
     {
-        moveOptionSelector(optionSelector, lcdEncoderState, optionsDriveAmount, optionsOnScreen);
-        for (uint8_t i = 0; i < 2; i++)
-        {
-            !i ? lcd_clrscr() : lcd_gotoxy(0, 1);
-            complement - i ? lcd_putc('-') : lcd_putc('>');
-            lcd_puts(projectDrive[*optionSelector + i]);
-        }
+        initEmergency(motorX, motorY, motorZ);
     }
-    else if (*projectOption == PROJECT_OPTION_CONFIG)
+    else if (emergency)
     {
-        moveOptionSelector(optionSelector, lcdEncoderState, optionsConfigAmount, optionsOnScreen);
-        for (uint8_t i = 0; i < 2; i++)
+        // leave the emergency state with the button
+        if (event->type == EVENT_BUTTON && !(PINE & _BV(PE4)))
         {
-            !i ? lcd_clrscr() : lcd_gotoxy(0, 1);
-            complement - i ? lcd_putc('-') : lcd_putc('>');
-            lcd_puts(projectConfig[*optionSelector + i]);
+            emergency = 0;
+            axesArrived = 0; // move done events dropped during the emergency are sent again
+            menu_render();
         }
     }
-    else if (*projectOption == PROJECT_OPTION_CONFIG_CALIBRATION)
+    else if (event->type == EVENT_LIMIT)
     {
-        lcd_clrscr();
-        lcd_puts("Bezig...");
-        while (!dcmotor_start_limit(motorX) || !dcmotor_start_limit(motorY))
-        {
-            dcmotor_instruction(motorX, DCMOTOR_BACKWARD);
-            dcmotor_instruction(motorY, DCMOTOR_BACKWARD);
-        }
-        position[0] = 0;
-        position[1] = 0;
-        moveToPosition[0] = 0;
-        moveToPosition[1] = 0;
-        lcd_clrscr();
-        lcd_puts("Start positie");
-        *projectOption = PROJECT_OPTION_CONFIG;
+        stopAtLimit(event->data);
     }
-    else if (*projectOption == PROJECT_OPTION_DRIVE_MANUAL)
+    else if (event->type == EVENT_MOVE_DONE)
     {
-        optionsOnScreen = 4;
-        const uint8_t backOption = 3;
-        if (lcdEncoderState == ENCODER_STATE_BUTTON && *optionSelector + complement < backOption)
-        {
-            moveOptionSelector(optionSelector, ENCODER_STATE_LEFT, optionsDriveManualAmount, optionsOnScreen);
-        }
-        else if (lcdEncoderState == ENCODER_STATE_BUTTON || (lcdEncoderState != ENCODER_STATE_BUTTON && *optionSelector + complement == backOption))
-        {
-            if (lcdEncoderState != ENCODER_STATE_BUTTON)
-            {
-                *projectOption = PROJECT_OPTION_DRIVE;
-            }
-            complement = 0;
-            *optionSelector = 0;
-        }
-        else if (lcdEncoderState == ENCODER_STATE_LEFT)
-        {
-            moveToPosition[*optionSelector + complement]++;
-        }
-        else if (lcdEncoderState == ENCODER_STATE_RIGHT)
-        {
-            moveToPosition[*optionSelector + complement]--;
-        }
-        for (uint8_t i = 0; i < optionsOnScreen; i++)
-        {
-            !i ? lcd_clrscr() : lcd_gotoxy(i % 2 ? LCD_DISP_LENGTH / 2 : 0, i > 1 ? 1 : 0);
-            complement - i ? lcd_putc('-') : lcd_putc('>');
-            lcd_puts(projectDriveManual[*optionSelector + i]);
-            if (i < backOption)
-                lcd_puti(moveToPosition[*optionSelector + i]);
-        }
+        moveDone();
     }
-    else if (*projectOption == PROJECT_OPTION_DRIVE_GRID)
-    {
-        optionsOnScreen = 4;
-        const uint8_t backOption = 3;
-        if (lcdEncoderState == ENCODER_STATE_BUTTON && *optionSelector + complement < backOption)
-        {
-            moveOptionSelector(optionSelector, ENCODER_STATE_LEFT, optionsDriveGridAmount, optionsOnScreen);
-        }
-        else if (lcdEncoderState == ENCODER_STATE_BUTTON || (lcdEncoderState != ENCODER_STATE_BUTTON && *optionSelector + complement == backOption))
-        {
-            if (lcdEncoderState != ENCODER_STATE_BUTTON)
-            {
-                *projectOption = PROJECT_OPTION_DRIVE;
-            }
-            complement = 0;
-            *optionSelector = 0;
-        }
-        else if (lcdEncoderState == ENCODER_STATE_LEFT)
-        {
-            grid[*optionSelector + complement]++;
-        }
-        else if (lcdEncoderState == ENCODER_STATE_RIGHT)
-        {
-            grid[*optionSelector + complement]--;
-        }
-
-        for (uint8_t i = 0; i < optionsOnScreen; i++)
-        {
-            !i ? lcd_clrscr() : lcd_gotoxy(!(i % 2) ? LCD_DISP_LENGTH / 2 : 0, 1);
-            complement - i ? lcd_putc('-') : lcd_putc('>');
-            lcd_puts(projectDriveGrid[*optionSelector + i]);
-            if (i == 0)
-            {
-                lcd_putc(' ');
-                lcd_putc(grid[0] + 'A');
-                lcd_puti(grid[1]);
-            }
-        }
-    }
-    else if (*projectOption == PROJECT_OPTION_INFO)
+    else
     {
-        moveOptionSelector(optionSelector, lcdEncoderState, optionsInfoAmount, optionsOnScreen);
-        for (uint8_t i = 0; i < 2; i++)
+        uint8_t input = menuEvent(event);
+        if (input != MENU_EVENT_NONE && menu_input(input) == MENU_REDRAW)
         {
-            !i ? lcd_clrscr() : lcd_gotoxy(0, 1);
-            lcd_puts(projectInfo[*optionSelector + i]);
+            menu_render();
         }
     }
 }
 
-uint8_t validateLcdState(uint8_t lcdEncoderState, uint8_t lcdEncoderPrevState)
+void controlTask()
 {
-    uint8_t hasActionsState = lcdEncoderState == ENCODER_STATE_RIGHT || lcdEncoderState == ENCODER_STATE_LEFT || lcdEncoderState == ENCODER_STATE_BUTTON;
-    uint8_t sameAsPrevState = lcdEncoderPrevState == lcdEncoderState;
-    return hasActionsState && !sameAsPrevState;
+    if (!emergency)
+    {
+        applySetpoints();
+        moveMotors(motorZ);
+    }
 }
 
-void moveMotors(DcMotor motorX, DcMotor motorY, StepMotor motorZ)
+void uiTask()
 {
-    readXEncoder();
-    readYEncoder();
-    for (uint8_t i = 0; i < 3; i++)
+    Event event;
+
+    // the ui only does work when an interrupt reported something
+    if (!event_pop(&event))
     {
-        if (position[i] != moveToPosition[i])
-        {
-            if (i == 0)
-            {
-                if (position[i] < moveToPosition[i])
-                {
-                    dcmotor_instruction(motorX, DCMOTOR_FORWARD);
-                }
-                else
-                {
-                    dcmotor_instruction(motorX, DCMOTOR_BACKWARD);
-                }
-            }
-            else if (i == 1)
-            {
-                if (position[i] < moveToPosition[i])
-                {
-                    dcmotor_instruction(motorY, DCMOTOR_FORWARD);
-                }
-                else
-                {
-                    dcmotor_instruction(motorY, DCMOTOR_BACKWARD);
-                }
-            }
-            else if (i == 2)
-            {
-                if (position[i] < moveToPosition[i])
-                {
-                    stepmotor_instruction(motorZ, STEPMOTOR_FORWARD);
-                }
-                else
-                {
-                    stepmotor_instruction(motorZ, STEPMOTOR_BACKWARD);
-                }
-            }
-        }
-        else
-        {
-            if (i == 0)
-            {
-                dcmotor_instruction(motorX, DCMOTOR_STOP);
-            }
-            else if (i == 1)
-            {
-                dcmotor_instruction(motorY, DCMOTOR_STOP);
-            }
-            else if (i == 2)
-            {
-                stepmotor_instruction(motorZ, STEPMOTOR_STOP);
-            }
-        }
+        return;
+    }
+    do
+    {
+        handleEvent(&event);
+    } while (event_pop(&event));
+
+    // the box geometry only changes from the menu, the cell tables follow it once no run uses them
+    if (!gridRun && grid_configure(&gridMap, boxDimension, boxMargin))
+    {
+        job_clear(&job); // the cells may be outside the new grid
+        jobFromSet = 0;
     }
 }
 
-void initEmergency(DcMotor motorX, DcMotor motorY, StepMotor motorZ)
+void lcdTask()
 {
-    lcd_clrscr();
-    lcd_puts("NOODSITUATIE!!!");
-    dcmotor_instruction(motorX, DCMOTOR_STOP);
-    dcmotor_instruction(motorY, DCMOTOR_STOP);
-    stepmotor_instruction(motorZ, DCMOTOR_STOP);
+    // the screen is sent in small parts so the other tasks never stall on the display
+    lcd_pump(LCD_PUMP_CELLS);
+}
+
+void telemetryTask();
+
+// ordered by priority
+SchedulerTask tasks[] = {
+    SCHEDULER_TASK(controlTask, CONTROL_PERIOD),
+    SCHEDULER_TASK(uiTask, UI_PERIOD),
+    SCHEDULER_TASK(lcdTask, LCD_PUMP_PERIOD),
+    SCHEDULER_TASK(telemetryTask, TELEMETRY_PERIOD),
+};
+
+#define TASK_COUNT (sizeof(tasks) / sizeof(SchedulerTask))
+
+// counters collected by telemetryTask(), read them with the debugger
+typedef struct
+{
+    uint32_t uptime;       // ms
+    uint16_t eventOverflows;
+    uint16_t encoderErrors[2];
+    uint16_t lcdPumpWorst; // systick ticks
+    uint16_t controlWorst; // systick ticks
+    uint16_t taskWorst[TASK_COUNT];
+    uint16_t taskOverruns[TASK_COUNT];
+} Telemetry;
+
+Telemetry telemetry;
+
+void telemetryTask()
+{
+    telemetry.uptime = systick_millis();
+    telemetry.eventOverflows = event_overflows();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        telemetry.encoderErrors[0] = xEncoder.errors;
+        telemetry.encoderErrors[1] = yEncoder.errors;
+    }
+    telemetry.lcdPumpWorst = lcd_pump_worst();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        telemetry.controlWorst = controlWorst;
+    }
+    for (uint8_t i = 0; i < TASK_COUNT; i++)
+    {
+        telemetry.taskWorst[i] = tasks[i].worst;
+        telemetry.taskOverruns[i] = tasks[i].overruns;
+    }
+#ifdef DEBUG_EN
+    DDRB |= _BV(DEBUG_PIN);
+    PORTB ^= _BV(DEBUG_PIN); // heartbeat
+#endif
 }
 
 int main(void)
 {
+    systick_init();
     lcd_init(LCD_DISP_ON);
     lcd_led(LCD_HIGH);
     DDRC &= ~(_BV(LCD_ENCODER_A) | _BV(LCD_ENCODER_B) | _BV(LCD_ENCODER_BUTTON)); // inputs
@@ -556,6 +966,7 @@ int main(void)
     PORTC |= _BV(Y_ENCODER_A) | _BV(Y_ENCODER_B);                                 // pull-up
     PORTC |= _BV(X_ENCODER_A) | _BV(X_ENCODER_B);                                 // pull-up
     PORTC |= _BV(LCD_ENCODER_A) | _BV(LCD_ENCODER_B) | _BV(LCD_ENCODER_BUTTON);   // pull-up
+    initEncoders();
 
     // external interrupt
     DDRE &= ~_BV(PE4); // input
@@ -564,15 +975,6 @@ int main(void)
     EIMSK |= _BV(INT4);
     sei();
 
-    uint8_t lcdEncoderState = ENCODER_STATE_NONE;
-    uint8_t projectOption = PROJECT_OPTION_NONE;
-    // projectOption = PROJECT_OPTION_DRIVE_GRID;
-    uint8_t lcdEncoderPrevState = ENCODER_STATE_UNKNOWN;
-    uint8_t optionSelector = 0;
-    uint8_t emergencyPrev = 0;
-    DcMotor motorX, motorY;
-    StepMotor motorZ;
-
     motorZ.ddrMoveDir = &DDRL;
     motorZ.portMoveDir = &PORTL;
     motorZ.pinMoveDir = Z_STEPPER_DIR;
@@ -595,6 +997,9 @@ int main(void)
     motorZ.portLimit = 0;
     motorZ.pinLimit = 0;
     motorZ.limit = 0;
+    motorZ.position = &position[2];
+    motorZ.speedMax = Z_SPEED_MAX;
+    motorZ.acceleration = Z_ACCELERATION;
 
     motorX.ddrA = &DDRL;
     motorX.portA = &PORTL;
@@ -610,6 +1015,13 @@ int main(void)
     motorX.portLimitB = &PORTA;
     motorX.pinLimitB = &PINA;
     motorX.limitB = PA1;
+    motorX.ddrPwm = &DDRH;
+    motorX.pinPwm = X_MOTOR_PWM;
+    motorX.tccrA = &TCCR4A;
+    motorX.tccrB = &TCCR4B;
+    motorX.icr = &ICR4;
+    motorX.ocr = &OCR4A;
+    motorX.com = _BV(COM4A1);
 
     motorY.ddrA = &DDRL;
     motorY.portA = &PORTL;
@@ -625,40 +1037,28 @@ int main(void)
     motorY.portLimitB = &PORTA;
     motorY.pinLimitB = &PINA;
     motorY.limitB = PA3;
+    motorY.ddrPwm = &DDRH;
+    motorY.pinPwm = Y_MOTOR_PWM;
+    motorY.tccrA = &TCCR4A;
+    motorY.tccrB = &TCCR4B;
+    motorY.icr = &ICR4;
+    motorY.ocr = &OCR4B;
+    motorY.com = _BV(COM4B1);
 
     dcmotor_init(motorX);
     dcmotor_init(motorY);
     stepmotor_init(motorZ);
+    initPositionControl();
+    grid_init(&gridMap, countsPerMm, travel);
+    grid_configure(&gridMap, boxDimension, boxMargin);
+    job_clear(&job);
 
-    changeOption(&projectOption, &optionSelector, lcdEncoderState, motorX, motorY);
+    menu_init(&menuMain);
+    menu_render();
 
+    scheduler_init(tasks, TASK_COUNT);
     while (1)
     {
-        readScreenEncoder(&lcdEncoderState);
-
-        if (emergency)
-        {
-            if (validateLcdState(lcdEncoderState, lcdEncoderPrevState) || !emergencyPrev)
-            {
-                emergencyPrev = 1;
-                initEmergency(motorX, motorY, motorZ);
-            }
-            if (lcdEncoderState == ENCODER_STATE_BUTTON && !(PINE & _BV(PE4)))
-            {
-                emergency = 0;
-            }
-            lcdEncoderPrevState = lcdEncoderState;
-            continue;
-        }
-
-        if (validateLcdState(lcdEncoderState, lcdEncoderPrevState) || emergencyPrev)
-        {
-            changeOption(&projectOption, &optionSelector, lcdEncoderState, motorX, motorY);
-        }
-
-        moveMotors(motorX, motorY, motorZ);
-
-        lcdEncoderPrevState = lcdEncoderState;
-        emergencyPrev = 0;
+        scheduler_run(tasks, TASK_COUNT);
     }
 }